@@ -29,6 +29,7 @@
 #define FREERTOS_CONFIG_H
 
 #include <avr/io.h>
+#include "config.h"
 
 /*-----------------------------------------------------------
  * Application specific definitions.
@@ -51,11 +52,25 @@
 #define configMINIMAL_STACK_SIZE	( ( unsigned short ) 85 )
 #define configTOTAL_HEAP_SIZE		( (size_t ) ( 1200 ) )
 #define configMAX_TASK_NAME_LEN		( 8 )
-#define configUSE_TRACE_FACILITY	0
+#define configUSE_TRACE_FACILITY	CONFIG_CONSOLE_TASKS
 #define configUSE_16_BIT_TICKS		1
 #define configIDLE_SHOULD_YIELD		0
 #define configQUEUE_REGISTRY_SIZE	0
 
+/* CONFIG_STATIC_ALLOCATION: no heap, link without a heap_x.c. main.c hands
+ * the kernel the idle task memory. */
+#define configSUPPORT_STATIC_ALLOCATION		CONFIG_STATIC_ALLOCATION
+#define configSUPPORT_DYNAMIC_ALLOCATION	(CONFIG_STATIC_ALLOCATION == 0)
+
+/* CPU time per task for CONSOLE TASKS, see console/console_runtime_avr.c. */
+#define configGENERATE_RUN_TIME_STATS	CONFIG_CONSOLE_TASKS
+#if CONFIG_CONSOLE_TASKS
+void ConsoleRunTimeInit(void);
+uint32_t ConsoleRunTimeCounter(void);
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()	ConsoleRunTimeInit()
+#define portGET_RUN_TIME_COUNTER_VALUE()			ConsoleRunTimeCounter()
+#endif
+
 /* Co-routine definitions. */
 #define configUSE_CO_ROUTINES 		0
 #define configMAX_CO_ROUTINE_PRIORITIES ( 2 )
@@ -70,6 +85,7 @@ to exclude the API function. */
 #define INCLUDE_vTaskSuspend			0
 #define INCLUDE_vTaskDelayUntil			1
 #define INCLUDE_vTaskDelay				1
+#define INCLUDE_xTaskGetCurrentTaskHandle	1
 
 
 #endif /* FREERTOS_CONFIG_H */
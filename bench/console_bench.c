@@ -0,0 +1,433 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Console benchmark for the Linux host build (port/linux). Runs one
+ * configuration and prints one JSON object on stdout, see bench/run.sh.
+ *
+ *	console_bench --mode logf --size 32 --args mix --channels 8 --producers 2 --count 2000
+ *
+ * mode      log: ConsoleLog with a plain string, logf: ConsoleLogf,
+ *           write: UsartWrite of raw bytes, command: HandleInputKey,
+ *           format: integer conversions with ConsoleFormat,
+ *           printi: the same conversions with the former engine,
+ *           bench/console_legacy.c, qwrite: the former per byte queue
+ *           UsartWrite, bench/usart_legacy.c
+ * size      payload bytes per message (log, logf, write, qwrite)
+ * args      none, int, str or mix, arguments of a logf message. For format
+ *           and printi int converts %d, the others rotate %d, %u and %x
+ * channels  channels created and used round robin
+ * producers tasks calling the API at the same time
+ * count     calls per producer
+ *
+ * Latency is the time spent in one API call. Wire throughput counts the
+ * bytes read back from the pty. Cycles come from the TSC on x86, elsewhere
+ * cycles_per_byte is null. format and printi write nothing to the pty and
+ * report cycles_per_conversion instead. qwrite counts the bytes its stand-in
+ * for the TX interrupt takes out of the queue.
+ *
+ * "compress" tells the console_bench_lz build, CONFIG_CONSOLE_COMPRESS=1, from
+ * the plain one. Its wire bytes are the compressed ones, so compare latency
+ * and calls_per_s of the two builds for the cost of the compressor.
+ *
+ * console.c provides printf() for the console port, results go out with
+ * fprintf(stdout, ...). */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC	1
+#else
+#define BENCH_HAVE_TSC	0
+#endif
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "console.h"
+#include "usart.h"
+#include "usart_linux.h"
+
+
+#define BENCH_MAX_SIZE	256
+/* Conversions per call of format and printi, so the timer calls around a
+ * call do not dominate. */
+#define BENCH_CONVERSIONS	16
+
+typedef enum
+{
+	BENCH_LOG,
+	BENCH_LOGF,
+	BENCH_WRITE,
+	BENCH_COMMAND,
+	BENCH_FORMAT,
+	BENCH_PRINTI,
+	BENCH_QWRITE
+}BenchMode;
+
+typedef enum
+{
+	BENCH_ARGS_NONE,
+	BENCH_ARGS_INT,
+	BENCH_ARGS_STR,
+	BENCH_ARGS_MIX
+}BenchArgs;
+
+typedef struct
+{
+	BenchMode mode;
+	BenchArgs args;
+	uint16_t size;
+	uint16_t channels;
+	uint16_t producers;
+	uint32_t count;
+}BenchConfig;
+
+static const char * const bench_modes[] = { "log", "logf", "write", "command", "format", "printi", "qwrite" };
+static const char * const bench_args[] = { "none", "int", "str", "mix" };
+
+static BenchConfig config = { BENCH_LOGF, BENCH_ARGS_MIX, 32, 1, 1, 1000 };
+
+static ConsoleChannel channels[CONFIG_CONSOLE_MAX_CHANNELS];
+static char keys[CONFIG_CONSOLE_MAX_CHANNELS][10];
+static UsartHandle port;
+static char payload[BENCH_MAX_SIZE + 1];
+static char format[BENCH_MAX_SIZE + 16];
+
+static uint32_t * latency_ns;
+static uint64_t * cycles;
+static TaskHandle_t control;
+
+static atomic_ulong wire_bytes;
+static atomic_ullong wire_last_ns;
+
+/* One to ten digits, both signs. */
+static const int bench_values[BENCH_CONVERSIONS] =
+{
+	0, 7, -42, 255, 1234, -32768, 65535, 100000,
+	-1000000, 9999999, 42424242, -123456789, 1000000000, 2147483647, -2147483647, 3
+};
+static volatile char bench_sink;
+
+/* Not exported by console.h, benchmarked directly. */
+void HandleInputKey(char *str);
+/* bench/console_legacy.c */
+int LegacyFormat(char *buf, uint16_t len, const char *format, ...);
+/* bench/usart_legacy.c */
+void LegacyUsartInit(size_t tx_buf_len, void (*sent)(uint16_t count));
+size_t LegacyUsartWrite(const uint8_t *data, uint16_t len);
+
+static uint64_t BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t BenchCycles(void)
+{
+#if BENCH_HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* Both modes go through a bounded snprintf of their engine, so the packing
+ * and format parsing around the conversion is measured on both sides. */
+static void BenchConvert(uint32_t i)
+{
+	static const char * const formats[] = { "%d", "%u", "%x" };
+	char buf[16];
+	for (uint8_t k = 0; k < BENCH_CONVERSIONS; k++)
+	{
+		const char *spec = formats[(config.args == BENCH_ARGS_INT) ? 0 : (i + k) % 3];
+		if (config.mode == BENCH_PRINTI)
+			LegacyFormat(buf, sizeof(buf), spec, bench_values[k]);
+		else
+			ConsoleFormat(buf, sizeof(buf), spec, bench_values[k]);
+		bench_sink += buf[0];
+	}
+}
+
+static void BenchReply(char *reply, const char **param, uint16_t count)
+{
+	ConsoleReplyf("ok");
+}
+
+/* Plain pthread draining the pty slave. It must not touch FreeRTOS and runs
+ * with all signals blocked so the POSIX port keeps its tick. */
+static void * BenchReader(void * param)
+{
+	int fd = *(int *)param;
+	char buf[512];
+	while (true)
+	{
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0)
+			continue;
+		atomic_fetch_add(&wire_bytes, (unsigned long)n);
+		atomic_store(&wire_last_ns, BenchNow());
+	}
+	return NULL;
+}
+
+static void BenchCount(uint16_t count)
+{
+	atomic_fetch_add(&wire_bytes, (unsigned long)count);
+	atomic_store(&wire_last_ns, BenchNow());
+}
+
+static void BenchStartReader(void)
+{
+	static int fd;
+	struct termios tio;
+	sigset_t all, old;
+	pthread_t thread;
+
+	fd = open(UsartLinuxDevice(USART_ID_0), O_RDWR | O_NOCTTY);
+	if (fd < 0)
+	{
+		perror("open pty");
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(fd, TCSANOW, &tio);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_create(&thread, NULL, BenchReader, &fd);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* The payload is padded with 'x' so the formatted body is about size bytes. */
+static void BenchBuildFormat(void)
+{
+	static const char * const prefix[] = { "", "%d %d %d %d ", "%s ", "%s %d %x %u " };
+	memset(payload, 'x', config.size);
+	payload[config.size] = 0;
+	snprintf(format, sizeof(format), "%s%s", prefix[config.args], payload);
+}
+
+static void BenchCall(uint32_t i)
+{
+	ConsoleChannel ch = channels[i % config.channels];
+	char command[24];
+
+	switch (config.mode)
+	{
+		case BENCH_LOG:
+		ConsoleLog(ch, CONSOLE_LEVEL_INFO, payload);
+		break;
+
+		case BENCH_LOGF:
+		switch (config.args)
+		{
+			case BENCH_ARGS_NONE:
+			ConsoleLogf(ch, CONSOLE_LEVEL_INFO, format);
+			break;
+			case BENCH_ARGS_INT:
+			ConsoleLogf(ch, CONSOLE_LEVEL_INFO, format, (int)i, -12345, 7, 32767);
+			break;
+			case BENCH_ARGS_STR:
+			ConsoleLogf(ch, CONSOLE_LEVEL_INFO, format, "sensor");
+			break;
+			case BENCH_ARGS_MIX:
+			ConsoleLogf(ch, CONSOLE_LEVEL_INFO, format, "sensor", (int)i, 0xBEEF, 4000u);
+			break;
+		}
+		break;
+
+		case BENCH_WRITE:
+		UsartWrite(port, (const uint8_t *)payload, config.size);
+		break;
+
+		case BENCH_QWRITE:
+		LegacyUsartWrite((const uint8_t *)payload, config.size);
+		break;
+
+		case BENCH_COMMAND:
+		snprintf(command, sizeof(command), "%s ping", keys[i % config.channels]);
+		HandleInputKey(command);
+		break;
+
+		case BENCH_FORMAT:
+		case BENCH_PRINTI:
+		BenchConvert(i);
+		break;
+	}
+}
+
+static void BenchProducer(void * param)
+{
+	uint32_t base = (uint32_t)(uintptr_t)param * config.count;
+	for (uint32_t i = 0; i < config.count; i++)
+	{
+		uint64_t c0 = BenchCycles();
+		uint64_t t0 = BenchNow();
+		BenchCall(i);
+		uint64_t t1 = BenchNow();
+		cycles[base + i] = BenchCycles() - c0;
+		latency_ns[base + i] = (uint32_t)(t1 - t0);
+	}
+	xTaskNotifyGive(control);
+	vTaskDelete(NULL);
+}
+
+static int BenchCompare(const void * a, const void * b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void BenchControl(void * param)
+{
+	uint32_t total = (uint32_t)config.producers * config.count;
+	bool convert = (config.mode == BENCH_FORMAT || config.mode == BENCH_PRINTI);
+
+	uint64_t start = BenchNow();
+	for (uintptr_t p = 0; p < config.producers; p++)
+		xTaskCreate(BenchProducer, "Prod", configMINIMAL_STACK_SIZE + CONSOLE_LOG_STACK, (void *)p, 1, NULL);
+	for (uint16_t p = 0; p < config.producers; p++)
+		ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+	uint64_t end = BenchNow();
+
+	/* Let the link drain: wait until no byte arrived for 50 ms. */
+	while (convert == false && (BenchNow() - atomic_load(&wire_last_ns) < 50000000ull || atomic_load(&wire_bytes) == 0))
+	{
+		vTaskDelay(10);
+		if (BenchNow() - end > 5000000000ull)
+			break;
+	}
+	uint64_t wire_end = atomic_load(&wire_last_ns);
+	unsigned long bytes = atomic_load(&wire_bytes);
+
+	uint64_t cycle_sum = 0;
+	for (uint32_t i = 0; i < total; i++)
+		cycle_sum += cycles[i];
+	qsort(latency_ns, total, sizeof(uint32_t), BenchCompare);
+
+	double seconds = (end - start) / 1e9;
+	double wire_seconds = (wire_end > start) ? (wire_end - start) / 1e9 : seconds;
+	fprintf(stdout, "{\"mode\":\"%s\",\"size\":%u,\"args\":\"%s\",\"channels\":%u,\"producers\":%u,\"count\":%u,\"compress\":%d,",
+		bench_modes[config.mode], config.size, bench_args[config.args], config.channels, config.producers, config.count,
+		CONFIG_CONSOLE_COMPRESS);
+	fprintf(stdout, "\"calls_per_s\":%.1f,\"wire_bytes\":%lu,\"wire_bytes_per_s\":%.1f,",
+		total / seconds, bytes, bytes / wire_seconds);
+	fprintf(stdout, "\"latency_ns\":{\"p50\":%u,\"p99\":%u,\"max\":%u},",
+		latency_ns[total / 2], latency_ns[(uint32_t)(total * 0.99)], latency_ns[total - 1]);
+	if (BENCH_HAVE_TSC && convert)
+		fprintf(stdout, "\"cycles_per_conversion\":%.2f}\n", (double)cycle_sum / ((double)total * BENCH_CONVERSIONS));
+	else if (BENCH_HAVE_TSC && bytes != 0)
+		fprintf(stdout, "\"cycles_per_byte\":%.2f}\n", (double)cycle_sum / bytes);
+	else
+		fprintf(stdout, "\"cycles_per_byte\":null}\n");
+	fflush(stdout);
+	exit(0);
+}
+
+static int BenchLookup(const char * const * names, int count, const char * name)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (strcmp(names[i], name) == 0)
+			return i;
+	}
+	fprintf(stderr, "unknown value %s\n", name);
+	exit(2);
+}
+
+static void BenchParse(int argc, char ** argv)
+{
+	static const struct option options[] =
+	{
+		{ "mode", required_argument, NULL, 'm' },
+		{ "size", required_argument, NULL, 's' },
+		{ "args", required_argument, NULL, 'a' },
+		{ "channels", required_argument, NULL, 'c' },
+		{ "producers", required_argument, NULL, 'p' },
+		{ "count", required_argument, NULL, 'n' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "m:s:a:c:p:n:", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'm': config.mode = BenchLookup(bench_modes, 7, optarg); break;
+			case 's': config.size = atoi(optarg); break;
+			case 'a': config.args = BenchLookup(bench_args, 4, optarg); break;
+			case 'c': config.channels = atoi(optarg); break;
+			case 'p': config.producers = atoi(optarg); break;
+			case 'n': config.count = atoi(optarg); break;
+			default: exit(2);
+		}
+	}
+	if (config.size > BENCH_MAX_SIZE)
+		config.size = BENCH_MAX_SIZE;
+	/* The CONSOLE channel takes one slot of the table. */
+	if (config.channels == 0 || config.channels >= CONFIG_CONSOLE_MAX_CHANNELS)
+	{
+		fprintf(stderr, "channels must be 1..%d\n", CONFIG_CONSOLE_MAX_CHANNELS - 1);
+		exit(2);
+	}
+	if (config.producers == 0 || config.count == 0)
+		exit(2);
+}
+
+int main(int argc, char ** argv)
+{
+	BenchParse(argc, argv);
+	BenchBuildFormat();
+	latency_ns = calloc((size_t)config.producers * config.count, sizeof(uint32_t));
+	cycles = calloc((size_t)config.producers * config.count, sizeof(uint64_t));
+
+	ConsoleInit();
+	port = UsartInit(USART_ID_0, BAUDRATE_9600, 64, 64);
+	for (uint16_t i = 0; i < config.channels; i++)
+	{
+		snprintf(keys[i], sizeof(keys[i]), "CH%u", i);
+		channels[i] = ConsoleCreate(keys[i], BenchReply);
+	}
+	BenchStartReader();
+	/* Same depth as the TX ring of port. */
+	if (config.mode == BENCH_QWRITE)
+		LegacyUsartInit(64, BenchCount);
+
+	xTaskCreate(BenchControl, "Bench", configMINIMAL_STACK_SIZE, NULL, 2, &control);
+	vTaskStartScheduler();
+	return 1;
+}
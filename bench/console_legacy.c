@@ -0,0 +1,284 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The print engine of console.c before the formatter rewrite, unchanged
+ * apart from names. Baseline of "console_bench --mode printi": int only,
+ * one % and one / per digit. */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LEGACY_MAX_ARGS	4
+#define LEGACY_READ_BYTE(p, flash)	(*(p))
+
+typedef union
+{
+	int i;
+	const char *s;
+} LegacyArg;
+
+typedef struct
+{
+	char *buf;
+	uint16_t len;
+	uint16_t pos;
+} LegacyOut;
+
+#define PAD_RIGHT 1
+#define PAD_ZERO 2
+
+static void printchar(LegacyOut *out, unsigned int c)
+{
+	if (out->pos + 1 < out->len)
+	out->buf[out->pos++] = (char)c;
+}
+
+static int prints(LegacyOut *out, const char *string, int width, int pad)
+{
+	register int pc = 0, padchar = ' ';
+
+	if (width > 0)
+	{
+		register int len = 0;
+		register const char *ptr;
+		for (ptr = string; *ptr; ++ptr)
+		++len;
+		if (len >= width)
+		width = 0;
+		else
+		width -= len;
+		if (pad & PAD_ZERO)
+		padchar = '0';
+	}
+	if (!(pad & PAD_RIGHT))
+	{
+		for (; width > 0; --width)
+		{
+			printchar(out, padchar);
+			++pc;
+		}
+	}
+	for (; *string; ++string)
+	{
+		printchar(out, *string);
+		++pc;
+	}
+	for (; width > 0; --width)
+	{
+		printchar(out, padchar);
+		++pc;
+	}
+
+	return pc;
+}
+
+/* the following should be enough for 32 bit int */
+#define PRINT_BUF_LEN 12
+
+static int printi(LegacyOut *out, int i, int b, int sg, int width, int pad, int letbase)
+{
+	char print_buf[PRINT_BUF_LEN];
+	register char *s;
+	register int t, neg = 0, pc = 0;
+	register unsigned int u = i;
+
+	if (i == 0)
+	{
+		print_buf[0] = '0';
+		print_buf[1] = '\0';
+		return prints(out, print_buf, width, pad);
+	}
+
+	if (sg && b == 10 && i < 0)
+	{
+		neg = 1;
+		u = -i;
+	}
+
+	s = print_buf + PRINT_BUF_LEN - 1;
+	*s = '\0';
+
+	while (u)
+	{
+		t = u % b;
+		if (t >= 10)
+		t += letbase - '0' - 10;
+		*--s = t + '0';
+		u /= b;
+	}
+
+	if (neg)
+	{
+		if (width && (pad & PAD_ZERO))
+		{
+			printchar(out, '-');
+			++pc;
+			--width;
+		}
+		else
+		{
+			*--s = '-';
+		}
+	}
+
+	return pc + prints(out, s, width, pad);
+}
+
+static int print(LegacyOut *out, const char *format, bool flash, const LegacyArg *args, uint8_t argc)
+{
+	register int width, pad;
+	register int pc = 0;
+	char scr[2];
+	char c;
+	const LegacyArg *end = args + argc;
+	const LegacyArg none = { 0 };
+
+	for (; (c = LEGACY_READ_BYTE(format, flash)) != 0; ++format)
+	{
+		if (c == '%')
+		{
+			c = LEGACY_READ_BYTE(++format, flash);
+			width = pad = 0;
+			if (c == '\0')
+			break;
+			if (c == '%')
+			goto out;
+			if (c == '-')
+			{
+				c = LEGACY_READ_BYTE(++format, flash);
+				pad = PAD_RIGHT;
+			}
+			while (c == '0')
+			{
+				c = LEGACY_READ_BYTE(++format, flash);
+				pad |= PAD_ZERO;
+			}
+			for (; c >= '0' && c <= '9'; c = LEGACY_READ_BYTE(++format, flash))
+			{
+				width *= 10;
+				width += c - '0';
+			}
+			const LegacyArg *arg = (args < end) ? args : &none;
+			if (c == 's')
+			{
+				register const char *s = arg->s;
+				pc += prints(out, s ? s : "(null)", width, pad);
+				++args;
+				continue;
+			}
+			if (c == 'd')
+			{
+				pc += printi(out, arg->i, 10, 1, width, pad, 'a');
+				++args;
+				continue;
+			}
+			if (c == 'x')
+			{
+				pc += printi(out, arg->i, 16, 0, width, pad, 'a');
+				++args;
+				continue;
+			}
+			if (c == 'X')
+			{
+				pc += printi(out, arg->i, 16, 0, width, pad, 'A');
+				++args;
+				continue;
+			}
+			if (c == 'u')
+			{
+				pc += printi(out, arg->i, 10, 0, width, pad, 'a');
+				++args;
+				continue;
+			}
+			if (c == 'c')
+			{
+				scr[0] = (char)arg->i;
+				scr[1] = '\0';
+				pc += prints(out, scr, width, pad);
+				++args;
+				continue;
+			}
+		}
+		else
+		{
+			out:
+			printchar(out, c);
+			++pc;
+		}
+	}
+	if (out)
+	out->buf[out->pos] = '\0';
+	return pc;
+}
+
+/* Copy the arguments referenced by format out of the va_list, so the
+ * message can be rendered later without the caller's stack frame. */
+static uint8_t LegacyPackArgs(LegacyArg *args, const char *format, bool flash, va_list ap)
+{
+	uint8_t count = 0;
+	char c;
+
+	for (; (c = LEGACY_READ_BYTE(format, flash)) != 0 && count < LEGACY_MAX_ARGS; ++format)
+	{
+		if (c != '%')
+		continue;
+		c = LEGACY_READ_BYTE(++format, flash);
+		if (c == '%')
+		continue;
+		while (c == '-' || (c >= '0' && c <= '9'))
+		c = LEGACY_READ_BYTE(++format, flash);
+		switch (c)
+		{
+			case 's':
+			args[count++].s = va_arg(ap, const char *);
+			break;
+			case 'd':
+			case 'x':
+			case 'X':
+			case 'u':
+			case 'c':
+			/* char are converted to int then pushed on the stack */
+			args[count++].i = va_arg(ap, int);
+			break;
+			case '\0':
+			return count;
+			default:
+			break;
+		}
+	}
+	return count;
+}
+
+int LegacyFormat(char *buf, uint16_t len, const char *format, ...)
+{
+	va_list args;
+	LegacyArg argv[LEGACY_MAX_ARGS];
+	LegacyOut out = { buf, len, 0 };
+
+	va_start(args, format);
+	uint8_t argc = LegacyPackArgs(argv, format, false, args);
+	va_end(args);
+	return print(&out, format, false, argv, argc);
+}
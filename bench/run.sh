@@ -0,0 +1,46 @@
+#!/bin/sh
+# Build the host benchmark and run the default matrix, one JSON object per line.
+#
+#	FREERTOS_KERNEL_PATH=/path/to/FreeRTOS-Kernel bench/run.sh > results.jsonl
+#
+# Compare two commits by diffing or joining their results on the config fields.
+
+set -e
+cd "$(dirname "$0")/../port/linux"
+make -s bench bench-lz
+REV=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+bench()
+{
+	build/console_bench "$@" 2>/dev/null | sed "s/^{/{\"commit\":\"$REV\",/"
+}
+
+bench_lz()
+{
+	build/console_bench_lz "$@" 2>/dev/null | sed "s/^{/{\"commit\":\"$REV\",/"
+}
+
+for mode in log write qwrite; do
+	for size in 8 32 128; do
+		bench --mode $mode --size $size --count 2000
+	done
+done
+for args in none int str mix; do
+	bench --mode logf --args $args --size 32 --count 2000
+done
+# The compressor against the same logf runs of the plain build.
+for args in none mix; do
+	bench_lz --mode logf --args $args --size 32 --count 2000
+done
+bench_lz --mode log --size 128 --count 2000
+for producers in 1 2 4; do
+	bench --mode logf --args mix --size 32 --channels 4 --producers $producers --count 1000
+done
+for channels in 1 4 16 60; do
+	bench --mode command --channels $channels --count 2000
+done
+for mode in printi format; do
+	for args in int mix; do
+		bench --mode $mode --args $args --count 20000
+	done
+done
@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* UsartWrite of usart.c before the byte rings, unchanged apart from names and
+ * the register access: one xQueueSend per byte. Baseline of
+ * "console_bench --mode qwrite". A task stands in for the UDRE interrupt and
+ * takes the bytes out one by one as the interrupt did, then counts them
+ * instead of sending them to the pty. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+static QueueHandle_t legacy_tx_queue;
+static TaskHandle_t legacy_tx_task;
+static void (*legacy_sent)(uint16_t count);
+
+static void LegacyTxTask(void * param)
+{
+	while (true)
+	{
+		BaseType_t wake_token = pdFALSE;
+		uint16_t count = 0;
+		uint8_t data;
+		taskENTER_CRITICAL();
+		while (xQueueReceiveFromISR(legacy_tx_queue, &data, &wake_token) == pdTRUE)
+			count++;
+		taskEXIT_CRITICAL();
+		if (count != 0)
+			legacy_sent(count);
+		if (wake_token != pdFALSE)
+			taskYIELD();
+		if (count == 0)
+			ulTaskNotifyTake(pdTRUE, 1);
+	}
+}
+
+void LegacyUsartInit(size_t tx_buf_len, void (*sent)(uint16_t count))
+{
+	legacy_sent = sent;
+	legacy_tx_queue = xQueueCreate(tx_buf_len, sizeof(uint8_t));
+	xTaskCreate(LegacyTxTask, "LegacyTx", configMINIMAL_STACK_SIZE, NULL, configMAX_PRIORITIES - 1, &legacy_tx_task);
+}
+
+size_t LegacyUsartWrite(const uint8_t * data, uint16_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		if (xQueueSend(legacy_tx_queue, &data[i], 1000) != pdTRUE)
+			return i;
+		/* Was UCSR0B |= 1 << UDRE0. */
+		xTaskNotifyGive(legacy_tx_task);
+	}
+	return len;
+}
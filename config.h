@@ -38,9 +38,153 @@
 #define CONFIG_CONSOLE_REPLY_BUFFER_LENGTH		64
 #endif
 
+/* A text line is formatted into a buffer this long on the stack of the logging task, then written at once. */
+#ifndef CONFIG_CONSOLE_LINE_LENGTH
+#define CONFIG_CONSOLE_LINE_LENGTH	80
+#endif
+
 #ifndef CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH	
 #define CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH	48
 #endif
 
+/* Number of channels ConsoleCreate can register, including the CONSOLE channel. */
+#ifndef CONFIG_CONSOLE_MAX_CHANNELS
+#define CONFIG_CONSOLE_MAX_CHANNELS	8
+#endif
+
+/* Output backends ConsoleAddSink accepts, including the UART (at most 8). */
+#ifndef CONFIG_CONSOLE_MAX_SINKS
+#define CONFIG_CONSOLE_MAX_SINKS	3
+#endif
+
+/* Messages below this level are compiled out: 0 trace, 1 debug, 2 info, 3 warning, 4 error, 5 none. */
+#ifndef CONFIG_CONSOLE_MIN_LEVEL
+#define CONFIG_CONSOLE_MIN_LEVEL	2
+#endif
+
+/* 1: ConsoleInfof/Warnf/Errorf only capture format and arguments, a low priority task formats them later. */
+#ifndef CONFIG_CONSOLE_DEFERRED
+#define CONFIG_CONSOLE_DEFERRED		0
+#endif
+
+/* 1: enable the Console*FromISR API. Shares the record queue with deferred mode. */
+#ifndef CONFIG_CONSOLE_ISR_LOG
+#define CONFIG_CONSOLE_ISR_LOG		0
+#endif
+
+#ifndef CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH
+#define CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH	8
+#endif
+
+/* Policy of new channels, see ConsolePolicy: 0 block, 1 try, 2 drop newest, 3 drop oldest. */
+#ifndef CONFIG_CONSOLE_DEFAULT_POLICY
+#define CONFIG_CONSOLE_DEFAULT_POLICY	0
+#endif
+
+/* Ticks a blocking log call waits for the console before the message is dropped. */
+#ifndef CONFIG_CONSOLE_BLOCK_TIMEOUT
+#define CONFIG_CONSOLE_BLOCK_TIMEOUT	10000
+#endif
+
+/* Arguments a deferred record or a crash log entry keeps of a formatted message. */
+#ifndef CONFIG_CONSOLE_MAX_ARGS
+#define CONFIG_CONSOLE_MAX_ARGS		4
+#endif
+
+/* 1: keep 64 bit arguments (%lld, %llu, %llx) at full width, 0 cuts them to a long. */
+#ifndef CONFIG_CONSOLE_PRINT_LONG_LONG
+#define CONFIG_CONSOLE_PRINT_LONG_LONG	0
+#endif
+
+/* 1: fixed point %f in the console print engine, 0 prints "?" for it. */
+#ifndef CONFIG_CONSOLE_PRINT_FLOAT
+#define CONFIG_CONSOLE_PRINT_FLOAT	0
+#endif
+
+/* Digits after the point of a %f without precision (at most 9). */
+#ifndef CONFIG_CONSOLE_FLOAT_PRECISION
+#define CONFIG_CONSOLE_FLOAT_PRECISION	3
+#endif
+
+/* Bytes per line of a ConsoleDump in text mode, the line must fit CONFIG_CONSOLE_LINE_LENGTH. */
+#ifndef CONFIG_CONSOLE_DUMP_WIDTH
+#define CONFIG_CONSOLE_DUMP_WIDTH	8
+#endif
+
+/* 1: send format string IDs and binary arguments instead of text, see tools/console_decode. */
+#ifndef CONFIG_CONSOLE_TOKENIZED
+#define CONFIG_CONSOLE_TOKENIZED	0
+#endif
+
+/* Longest encoded tokenized message in bytes, longer ones lose their last arguments. */
+#ifndef CONFIG_CONSOLE_TOKEN_RECORD_LENGTH
+#define CONFIG_CONSOLE_TOKEN_RECORD_LENGTH	32
+#endif
+
+/* 1: send every message as a COBS frame with sequence number, tick and CRC, see tools/console_frame.h. */
+#ifndef CONFIG_CONSOLE_FRAMED
+#define CONFIG_CONSOLE_FRAMED	0
+#endif
+
+/* Longest frame before COBS encoding (at most 254), longer messages are cut. */
+#ifndef CONFIG_CONSOLE_FRAME_LENGTH
+#define CONFIG_CONSOLE_FRAME_LENGTH	80
+#endif
+
+/* 1: LZSS compress the console output, see tools/console_unlz. Not with CONFIG_CONSOLE_FRAMED. */
+#ifndef CONFIG_CONSOLE_COMPRESS
+#define CONFIG_CONSOLE_COMPRESS	0
+#endif
+
+/* History the compressor matches against, bytes of RAM (at most 4095). */
+#ifndef CONFIG_CONSOLE_COMPRESS_WINDOW
+#define CONFIG_CONSOLE_COMPRESS_WINDOW	256
+#endif
+
+/* Hash buckets of the compressor's match search (power of 2), 4 bytes of RAM each, 8 with a window over 256. */
+#ifndef CONFIG_CONSOLE_COMPRESS_HASH
+#define CONFIG_CONSOLE_COMPRESS_HASH	32
+#endif
+
+/* TX ring of the UART high lane, errors take it past queued lines. 0: one lane. Not with CONFIG_CONSOLE_FRAMED or CONFIG_CONSOLE_COMPRESS. */
+#ifndef CONFIG_CONSOLE_TX_HIGH_LENGTH
+#define CONFIG_CONSOLE_TX_HIGH_LENGTH	0
+#endif
+
+/* 1: count log calls, drops, lock waits and buffer peaks for the CONSOLE STATS command. */
+#ifndef CONFIG_CONSOLE_STATS
+#define CONFIG_CONSOLE_STATS	0
+#endif
+
+/* 1: add the CONSOLE TASKS command, turns on FreeRTOS run time stats (Timer2 on the AVR), needs heap_4 or heap_5. */
+#ifndef CONFIG_CONSOLE_TASKS
+#define CONFIG_CONSOLE_TASKS	0
+#endif
+
+/* Tasks CONSOLE TASKS can list, the status of each takes about 20 bytes of RAM. */
+#ifndef CONFIG_CONSOLE_TASKS_MAX
+#define CONFIG_CONSOLE_TASKS_MAX	8
+#endif
+
+/* 1: keep the last log records in a .noinit RAM ring, the console task prints them again after a reset. */
+#ifndef CONFIG_CONSOLE_CRASH_LOG
+#define CONFIG_CONSOLE_CRASH_LOG	0
+#endif
+
+/* Records the crash log holds (at most 255). */
+#ifndef CONFIG_CONSOLE_CRASH_LOG_LENGTH
+#define CONFIG_CONSOLE_CRASH_LOG_LENGTH	8
+#endif
+
+/* 1: console and usart take no heap (UsartInitStatic), FreeRTOS objects are created static. The AVR build then has no heap at all. */
+#ifndef CONFIG_STATIC_ALLOCATION
+#define CONFIG_STATIC_ALLOCATION	0
+#endif
+
+/* Linux host port: 1 limits every pty to the bytes its baud rate would carry per tick. */
+#ifndef CONFIG_USART_LINUX_PACED
+#define CONFIG_USART_LINUX_PACED	0
+#endif
+
 
 #endif /* CONFIG_INCLUDE_H_ */
\ No newline at end of file
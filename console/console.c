@@ -24,6 +24,8 @@
 
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <limits.h>
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
@@ -33,167 +35,1014 @@
 #include <string.h>
 #include "usart.h"
 
+#define CONSOLE_USE_RECORDS	(CONFIG_CONSOLE_DEFERRED || CONFIG_CONSOLE_ISR_LOG)
+/* Binary output, the host learns the channel keys from announcements. */
+#define CONSOLE_USE_WIRE	(CONFIG_CONSOLE_TOKENIZED || CONFIG_CONSOLE_FRAMED)
+/* Errors go out on the high lane of the UART. */
+#define CONSOLE_USE_LANES	(CONFIG_CONSOLE_TX_HIGH_LENGTH > 0)
+
+#if CONSOLE_USE_RECORDS && CONFIG_CONSOLE_TOKENIZED == 0 && CONFIG_CONSOLE_MAX_ARGS > 8
+#error "CONFIG_CONSOLE_MAX_ARGS must fit the 8 argument types of a log call."
+#endif
+
+#if CONFIG_CONSOLE_FRAMED && CONFIG_CONSOLE_FRAME_LENGTH > 254
+#error "CONFIG_CONSOLE_FRAME_LENGTH must fit in one COBS block (254 bytes)."
+#endif
+
+#if CONFIG_CONSOLE_COMPRESS && CONFIG_CONSOLE_FRAMED
+#error "CONFIG_CONSOLE_COMPRESS would break the frame boundaries, use one or the other."
+#endif
+
+#if CONSOLE_USE_LANES && (CONFIG_CONSOLE_FRAMED || CONFIG_CONSOLE_COMPRESS)
+#error "CONFIG_CONSOLE_TX_HIGH_LENGTH reorders the output, frames and the compressed stream must stay in order."
+#endif
+
+#if CONSOLE_USE_LANES && CONFIG_CONSOLE_TOKENIZED && CONFIG_CONSOLE_TX_HIGH_LENGTH < CONFIG_CONSOLE_TOKEN_RECORD_LENGTH
+#error "CONFIG_CONSOLE_TX_HIGH_LENGTH must hold a whole record of CONFIG_CONSOLE_TOKEN_RECORD_LENGTH bytes."
+#elif CONSOLE_USE_LANES && CONFIG_CONSOLE_TOKENIZED == 0 && CONFIG_CONSOLE_TX_HIGH_LENGTH < CONFIG_CONSOLE_LINE_LENGTH
+#error "CONFIG_CONSOLE_TX_HIGH_LENGTH must hold a whole line of CONFIG_CONSOLE_LINE_LENGTH bytes."
+#endif
+
+#if CONFIG_CONSOLE_COMPRESS && CONFIG_CONSOLE_COMPRESS_WINDOW > 4095
+#error "CONFIG_CONSOLE_COMPRESS_WINDOW must fit in a 12 bit distance."
+#endif
+
+#if CONFIG_CONSOLE_COMPRESS && (CONFIG_CONSOLE_COMPRESS_HASH > 256 || (CONFIG_CONSOLE_COMPRESS_HASH & (CONFIG_CONSOLE_COMPRESS_HASH - 1)) != 0)
+#error "CONFIG_CONSOLE_COMPRESS_HASH must be a power of 2 up to 256."
+#endif
+
+#if CONFIG_CONSOLE_MAX_SINKS > 8
+#error "CONFIG_CONSOLE_MAX_SINKS must fit the 8 bit sink selection."
+#endif
+
+#if CONFIG_CONSOLE_PRINT_FLOAT && CONFIG_CONSOLE_FLOAT_PRECISION > 9
+#error "CONFIG_CONSOLE_FLOAT_PRECISION must be at most 9 digits."
+#endif
+
+#if CONFIG_CONSOLE_CRASH_LOG && (CONFIG_CONSOLE_CRASH_LOG_LENGTH < 1 || CONFIG_CONSOLE_CRASH_LOG_LENGTH > 255)
+#error "CONFIG_CONSOLE_CRASH_LOG_LENGTH must be 1 to 255 records."
+#endif
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_1)
+#define CONSOLE_LOAD(v)			__atomic_load_n(&(v), __ATOMIC_ACQUIRE)
+#define CONSOLE_STORE(v, x)		__atomic_store_n(&(v), (x), __ATOMIC_RELEASE)
+#else
+#define CONSOLE_LOAD(v)			(v)
+#define CONSOLE_STORE(v, x)		((v) = (x))
+#endif
+
+#if CONFIG_CONSOLE_STATS
+#define CONSOLE_STAT(x)			(x)
+#define CONSOLE_PEAK(peak, value)	do { if ((value) > (peak)) (peak) = (value); } while (0)
+#else
+#define CONSOLE_STAT(x)			((void)0)
+#define CONSOLE_PEAK(peak, value)	((void)0)
+#endif
+
+/* Stack of the console task without a directly logged line, in words. */
+#define CONSOLE_TASK_STACK		164
+/* The log task formats every deferred line. */
+#define CONSOLE_LOG_TASK_STACK	(CONSOLE_TASK_STACK + CONFIG_CONSOLE_LINE_LENGTH)
+
+/* TX ring of the console UART, input arrives in lines of
+ * CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH. */
+#define CONSOLE_UART_TX_LENGTH	64
+
+#if defined(__AVR__)
+#define CONSOLE_READ_BYTE(p, flash)	((flash) ? (char)pgm_read_byte(p) : *(p))
+#define CONSOLE_READ_PTR(p)			pgm_read_ptr(&(p))
+#else
+#define CONSOLE_READ_BYTE(p, flash)	(*(p))
+#define CONSOLE_READ_PTR(p)			(p)
+#endif
+
 typedef enum
 {
-	CONSOLE_MESSAGE_INFO,
-	CONSOLE_MESSAGE_WARN,
-	CONSOLE_MESSAGE_ERROR,
-	CONSOLE_MESSAGE_REPLY
+	CONSOLE_MESSAGE_TRACE = CONSOLE_LEVEL_TRACE,
+	CONSOLE_MESSAGE_DEBUG = CONSOLE_LEVEL_DEBUG,
+	CONSOLE_MESSAGE_INFO = CONSOLE_LEVEL_INFO,
+	CONSOLE_MESSAGE_WARN = CONSOLE_LEVEL_WARN,
+	CONSOLE_MESSAGE_ERROR = CONSOLE_LEVEL_ERROR,
+	CONSOLE_MESSAGE_REPLY = CONSOLE_LEVEL_NONE
 } ConsoleMessageType;
 
-typedef struct _dbg
+#if CONFIG_CONSOLE_PRINT_LONG_LONG
+typedef unsigned long long ConsoleUint;
+typedef long long ConsoleInt;
+#define CONSOLE_UINT_MAX	ULLONG_MAX
+#else
+typedef unsigned long ConsoleUint;
+typedef long ConsoleInt;
+#define CONSOLE_UINT_MAX	ULONG_MAX
+#endif
+
+/* Integers are widened to ConsoleUint when packed, sign extended for %d and
+ * zero extended for the other conversions. */
+typedef union
+{
+	ConsoleUint u;
+	const char *s;
+	double f;
+} ConsoleArg;
+
+/* Arguments of print(): straight from the caller's va_list, or packed in a
+ * record. Packed arguments past end read as 0. */
+typedef struct
+{
+	va_list *ap;
+	const ConsoleArg *args;
+	const ConsoleArg *end;
+} ConsoleArgs;
+
+#define CONSOLE_ARGS(args, argc)	{ NULL, (args), (args) + (argc) }
+
+/* Output of print(): out == NULL writes to the console port. */
+typedef struct
+{
+	char *buf;
+	uint16_t len;
+	uint16_t pos;
+} ConsoleOut;
+
+/* Token of a command word: first letter, last letter and length. It is
+ * unique for every built-in word, a match is confirmed with one compare. */
+#define CONSOLE_VERB(first, last, len)	((uint16_t)((((first) & 0x1F) << 11) | (((last) & 0x1F) << 6) | ((len) & 0x3F)))
+
+#define CONSOLE_RECORD_LITERAL	0xFF
+/* Types of a direct ConsoleLogf call, read from the format. No argument type is 0xF. */
+#define CONSOLE_TYPES_FORMAT	0xFFFFFFFFul
+
+/* Tokenized wire format, one record per message:
+ *	0x1E, length of the rest, kind | level, channel index, body
+ * Token body: varint offset of the format string, then the arguments in
+ * order. Integers are zigzag varints, doubles 4 byte little endian floats,
+ * strings a length byte and the characters. Dump body: 16 bit little endian
+ * offset, then the bytes. */
+#define CONSOLE_WIRE_START		0x1E
+#define CONSOLE_WIRE_TOKEN		0x00
+#define CONSOLE_WIRE_TEXT		0x10
+#define CONSOLE_WIRE_CHANNEL	0x20
+#define CONSOLE_WIRE_DUMP		0x30
+#define CONSOLE_WIRE_HEADER		4
+
+/* Framed output (CONFIG_CONSOLE_FRAMED), one COBS encoded frame per message
+ * followed by 0x00. Before encoding:
+ *	kind | level, channel index, sequence (2), tick (4), body, CRC-16 (2)
+ * Multi-byte fields are little endian, the CRC is CRC-16/CCITT-FALSE over
+ * everything before it. The body is the text, a token body, a dump body or a
+ * channel key. */
+#define CONSOLE_FRAME_HEADER	8
+
+#if CONFIG_CONSOLE_FRAMED
+#define CONSOLE_NOW()			xTaskGetTickCount()
+#define CONSOLE_RECORD_TICK(rec)	((rec).tick)
+#else
+#define CONSOLE_NOW()			0
+#define CONSOLE_RECORD_TICK(rec)	0
+#endif
+
+typedef struct
+{
+#if CONFIG_CONSOLE_TOKENIZED
+	ConsoleNode *node;
+	uint8_t len;
+	volatile uint8_t ready;
+	uint8_t data[CONFIG_CONSOLE_TOKEN_RECORD_LENGTH];
+#else
+	const char *format;
+	ConsoleNode *node;
+	uint8_t type;
+	uint8_t argc;
+	volatile uint8_t ready;
+	ConsoleArg args[CONFIG_CONSOLE_MAX_ARGS];
+#endif
+#if CONFIG_CONSOLE_FRAMED
+	TickType_t tick;
+#endif
+} ConsoleRecord;
+
+/* Crash log (CONFIG_CONSOLE_CRASH_LOG), a copy of the last records in RAM the
+ * startup code leaves alone. It is trusted after a reset when the magic and
+ * the CRC-16 over magic, head and count match, each entry has a CRC-16 of its
+ * own. Both CRCs start from the identity of the firmware, so a log written by
+ * another build is dropped. An entry is written before the header is
+ * updated, so a reset part way through loses only that entry. Entries refer
+ * to channels by index and, in text mode, to format strings in flash, both
+ * are the same after a reset into the same firmware. */
+#define CONSOLE_CRASH_MAGIC		0xC0DE
+
+typedef struct
 {
-	char key[10];
-	ConsoleHandler handler;
-	bool enable_error_log;
-	bool enable_warning;
-	bool enable_info;
+	uint16_t crc;
+#if CONFIG_CONSOLE_TOKENIZED
+	uint8_t len;
+	uint8_t data[CONFIG_CONSOLE_TOKEN_RECORD_LENGTH];
+#else
+	const char *format;
+	uint8_t channel;
+	uint8_t type;
+	uint8_t argc;
+	ConsoleArg args[CONFIG_CONSOLE_MAX_ARGS];
+#endif
+#if CONFIG_CONSOLE_FRAMED
+	TickType_t tick;
+#endif
+} ConsoleCrashEntry;
 
-	struct _dbg *pNext;
-} ConsoleNode;
+typedef struct
+{
+	uint16_t magic;
+	uint8_t head;
+	uint8_t count;
+	uint16_t crc;
+	ConsoleCrashEntry entries[CONFIG_CONSOLE_CRASH_LOG_LENGTH];
+} ConsoleCrashLog;
+
+/* State of the frame being written, owned by whoever holds the console lock.
+ * A frame is encoded once per sink, each sink numbers its own frames. */
+typedef struct
+{
+	ConsoleSink *sink;
+	uint8_t block[CONFIG_CONSOLE_FRAME_LENGTH];
+	uint8_t fill;
+	uint8_t len;
+	uint16_t crc;
+} ConsoleFrame;
+
+/* Compressed output (CONFIG_CONSOLE_COMPRESS), LZSS in groups of 8 items:
+ *	control byte, bit n set: item n is a reference, else a literal byte
+ * A reference is 2 bytes, the low 8 bits of the distance, then the high 4
+ * bits of the distance and the match length - 3. Distance 0 ends the group
+ * early, every message is flushed that way so it leaves at once.
+ * Matches are looked up in a hash table of the first 3 bytes, each bucket
+ * keeps the four latest window positions, so a step tries at most four. */
+#define CONSOLE_LZ_MIN_MATCH	3
+#define CONSOLE_LZ_MAX_MATCH	18
+#define CONSOLE_LZ_WAYS			4
+
+/* Positions count the bytes that entered the window and wrap, a byte is
+ * enough up to a 256 byte window. */
+#if CONFIG_CONSOLE_COMPRESS_WINDOW <= 256
+typedef uint8_t ConsoleLzPos;
+#else
+typedef uint16_t ConsoleLzPos;
+#endif
 
 typedef struct
 {
-	bool enable_error_log;
-	bool enable_warning;
-	bool enable_info;
+	uint8_t window[CONFIG_CONSOLE_COMPRESS_WINDOW];
+	uint16_t head;
+	uint16_t filled;
+	ConsoleLzPos count;
+	ConsoleLzPos buckets[CONFIG_CONSOLE_COMPRESS_HASH][CONSOLE_LZ_WAYS];
+	uint8_t ahead[CONSOLE_LZ_MAX_MATCH];
+	uint8_t ahead_len;
+	uint8_t group[1 + 8 * 2];
+	uint8_t group_len;
+	uint8_t items;
+} ConsoleLz;
+
+/* Counters of CONSOLE STATS. A lock wait is a caller that did not get the
+ * lock at once and waited for it, a timeout one whose wait ran out. The peaks are the longest line or record and reply seen and
+ * the deepest the record queue got. */
+typedef struct
+{
+	uint32_t lock_wait_ticks;
+	uint16_t lock_waits;
+	uint16_t lock_wait_max;
+	uint16_t lock_timeouts;
+	uint16_t line_peak;
+	uint16_t reply_peak;
+	uint8_t queue_peak;
+} ConsoleStats;
 
+typedef struct
+{
 	xSemaphoreHandle lock;
+#if CONSOLE_USE_LANES
+	/* Writers of the UART high lane, they never wait for lock. */
+	xSemaphoreHandle urgent_lock;
+	/* The port has its high lane, errors take it. */
+	bool lanes;
+#endif
 
 	UsartHandle port;
-
-	ConsoleNode *pHead;
+	/* The port assembles command lines, false when it had no memory for them. */
+	bool input;
+
+	/* Output backends, sinks[0] is the UART. sink_select has a bit per sink
+	 * that takes the message being written, sink_wait the ones of them a
+	 * blocking message has to wait for. */
+	ConsoleSink *sinks[CONFIG_CONSOLE_MAX_SINKS];
+	uint8_t sink_count;
+	uint8_t sink_select;
+	uint8_t sink_wait;
+
+	/* Registered channels, sorted by key hash. */
+	ConsoleNode *channels[CONFIG_CONSOLE_MAX_CHANNELS];
+	uint8_t channel_count;
 	ConsoleNode *con_node;
 
 	char reply[CONFIG_CONSOLE_REPLY_BUFFER_LENGTH];
-	uint8_t buffer[CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH];
-	uint8_t index;
+	uint16_t reply_len;
+	/* Channel of the command being handled, and whether its handler sent
+	 * lines of its own with ConsoleReplyFlush. */
+	ConsoleNode *reply_node;
+	bool reply_flushed;
+
+#if CONSOLE_USE_RECORDS
+	TaskHandle_t log_task;
+	ConsoleRecord records[CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH];
+	volatile uint8_t rec_head;
+	volatile uint8_t rec_tail;
+#endif
+
+#if CONSOLE_USE_WIRE
+	/* Channels are announced once the console task runs. */
+	bool announced;
+#endif
+
+#if CONFIG_CONSOLE_FRAMED
+	ConsoleFrame frame;
+#endif
+
+#if CONFIG_CONSOLE_COMPRESS
+	ConsoleLz lz;
+#endif
+
+#if CONFIG_CONSOLE_STATS
+	ConsoleStats stats;
+#endif
+
+#if CONFIG_CONSOLE_CRASH_LOG
+	/* Records go to the crash log once the one from before the reset is out. */
+	volatile bool crash_armed;
+#endif
 } ConsoleManager;
 
 ConsoleManager con_man;
+volatile uint8_t console_level_mask = CONSOLE_MASK_ALL;
+
+#if CONFIG_STATIC_ALLOCATION
+/* Everything ConsoleInit and ConsoleCreate otherwise take from the heap.
+ * Every channel has its node here, used or not. */
+typedef struct
+{
+	ConsoleNode nodes[CONFIG_CONSOLE_MAX_CHANNELS];
+	uint8_t node_count;
+	StaticSemaphore_t lock;
+	uint8_t rx[USART_RING_SIZE(0)];
+	uint8_t tx[USART_RING_SIZE(CONSOLE_UART_TX_LENGTH)];
+	uint8_t lines[USART_LINE_SIZE(CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH)];
+#if CONSOLE_USE_LANES
+	StaticSemaphore_t urgent_lock;
+	uint8_t tx_high[USART_RING_SIZE(CONFIG_CONSOLE_TX_HIGH_LENGTH)];
+#endif
+	StaticTask_t task;
+	StackType_t stack[CONSOLE_TASK_STACK + CONSOLE_LOG_STACK];
+#if CONSOLE_USE_RECORDS
+	StaticTask_t log_task;
+	StackType_t log_stack[CONSOLE_LOG_TASK_STACK];
+#endif
+} ConsoleStatic;
+
+static ConsoleStatic console_static;
+#endif
+
+static void ConsoleUartWrite(ConsoleSink *sink, const uint8_t *data, uint16_t len);
+static uint16_t ConsoleUartSpace(ConsoleSink *sink);
+
+static ConsoleSink console_uart_sink =
+{
+	ConsoleUartWrite,
+	ConsoleUartSpace,
+	CONSOLE_MASK_ALL | CONSOLE_MASK_REPLY,
+#if CONFIG_CONSOLE_FRAMED
+	0
+#endif
+};
 
 void ConsoleTask(void *param);
+void ConsoleLogTask(void *param);
+#if CONSOLE_USE_WIRE
+static void ConsoleSendText(ConsoleNode *node, ConsoleMessageType type, const char *text);
+static void ConsoleAnnounce(ConsoleNode *node);
+#endif
+#if CONFIG_CONSOLE_TOKENIZED
+static bool ConsoleRenderBytes(const uint8_t *data, uint8_t len, uint8_t policy, TickType_t tick);
+static uint8_t ConsoleTokenEncode(uint8_t *data, ConsoleNode *node, uint8_t level, const char *token, uint32_t types, va_list ap);
+#else
+static bool ConsoleRender(ConsoleNode *node, ConsoleMessageType type, const char *format, ConsoleArgs *in, uint8_t policy, TickType_t tick);
+static bool ConsoleSendLine(ConsoleNode *node, uint8_t kind, const uint8_t *line, uint16_t len, uint8_t policy, TickType_t tick);
+#if CONFIG_CONSOLE_DEFERRED == 0
+static void ConsoleEmit(ConsoleNode *node, ConsoleMessageType type, const char *format, va_list *ap);
+#endif
+#endif
+static void ConsoleReportDrops(ConsoleNode *node, uint8_t policy);
+#if CONFIG_CONSOLE_CRASH_LOG
+static void ConsoleCrashCheck(void);
+static void ConsoleCrashReplay(void);
+#if CONFIG_CONSOLE_TOKENIZED
+static void ConsoleCrashSave(const uint8_t *data, uint8_t len, TickType_t tick, bool from_isr);
+#else
+static void ConsoleCrashSave(const ConsoleNode *node, uint8_t type, const char *format, const ConsoleArg *args, uint8_t argc, TickType_t tick, bool from_isr);
+#endif
+#else
+#define ConsoleCrashSave(...)	((void)0)
+#endif
+#if CONSOLE_USE_WIRE == 0
+static void ConsoleFormatKey(ConsoleOut *out, ConsoleMessageType type, const char *key);
+#endif
+#if CONFIG_CONSOLE_TOKENIZED
+static uint8_t ConsoleTokenize(uint8_t *data, ConsoleNode *node, uint8_t level, const char *token, uint32_t types, ...);
+#endif
+#if CONSOLE_USE_RECORDS && CONFIG_CONSOLE_TOKENIZED == 0
+static bool ConsoleRecordSubmit(ConsoleNode *node, ConsoleMessageType type, const char *format, uint32_t types, va_list *ap, bool from_isr);
+#endif
 void ConsoleKeyHandler(char *reply, const char **param, uint16_t count);
-void ConsoleSendByte(uint8_t byte);
+void ToUpperCase(char * input);
+
+static uint16_t ConsoleHash(const char *key)
+{
+	uint16_t hash = 0;
+	while (*key != 0)
+	hash = hash * 31 + (uint8_t)*key++;
+	return hash;
+}
+
+/* Copy and upper case the key once, then insert the node in hash order. */
+static ConsoleNode *ConsoleRegister(ConsoleNode *node, const char *key, bool flash, ConsoleHandler handler)
+{
+	if (node == NULL || con_man.channel_count >= CONFIG_CONSOLE_MAX_CHANNELS)
+	return NULL;
+
+	memset(node->key, 0, sizeof(node->key));
+	char c;
+	for (uint8_t i = 0; i < sizeof(node->key) - 1 && (c = CONSOLE_READ_BYTE(&key[i], flash)) != 0; i++)
+	node->key[i] = c;
+	ToUpperCase(node->key);
+	node->hash = ConsoleHash(node->key);
+	node->handler = handler;
+	node->commands = NULL;
+	node->command_count = 0;
+	node->policy = CONFIG_CONSOLE_DEFAULT_POLICY;
+	node->dropped = 0;
+	node->base.level_mask = CONSOLE_MASK_ALL;
+#if CONFIG_CONSOLE_STATS
+	node->logged = 0;
+	node->lost = 0;
+#endif
+
+	node->index = con_man.channel_count;
+	uint8_t i = con_man.channel_count++;
+	while (i > 0 && con_man.channels[i - 1]->hash > node->hash)
+	{
+		con_man.channels[i] = con_man.channels[i - 1];
+		i--;
+	}
+	con_man.channels[i] = node;
+	return node;
+}
+
+/* key must already be upper case. */
+static ConsoleNode *ConsoleFind(const char *key)
+{
+	uint16_t hash = ConsoleHash(key);
+	uint8_t lo = 0;
+	uint8_t hi = con_man.channel_count;
+	while (lo < hi)
+	{
+		uint8_t mid = (lo + hi) / 2;
+		if (con_man.channels[mid]->hash < hash)
+		lo = mid + 1;
+		else
+		hi = mid;
+	}
+	for (; lo < con_man.channel_count && con_man.channels[lo]->hash == hash; lo++)
+	{
+		if (strcmp(con_man.channels[lo]->key, key) == 0)
+		return con_man.channels[lo];
+	}
+	return NULL;
+}
+
+static void ConsoleChannelsCommand(char *reply, const char **param, uint16_t count);
+#if CONFIG_CONSOLE_STATS
+static void ConsoleStatsCommand(char *reply, const char **param, uint16_t count);
+#endif
+#if CONFIG_CONSOLE_TASKS
+static void ConsoleTasksCommand(char *reply, const char **param, uint16_t count);
+#endif
+
+/* Command words of the CONSOLE channel. */
+static const ConsoleCommand console_commands[] =
+{
+	{ "CHANNELS", ConsoleChannelsCommand },
+#if CONFIG_CONSOLE_STATS
+	{ "STATS", ConsoleStatsCommand },
+#endif
+#if CONFIG_CONSOLE_TASKS
+	{ "TASKS", ConsoleTasksCommand },
+#endif
+};
+
+/* CONSOLE_CHANNEL_DEFINE entries, in link order. Weak, so a firmware without
+ * any gets an empty range. */
+extern const ConsoleChannelDef __start_console_channels[] __attribute__((weak));
+extern const ConsoleChannelDef __stop_console_channels[] __attribute__((weak));
+
+/* Storage of the next channel, nodes are never freed. */
+static ConsoleNode *ConsoleNodeAlloc(void)
+{
+	if (con_man.channel_count >= CONFIG_CONSOLE_MAX_CHANNELS)
+	return NULL;
+#if CONFIG_STATIC_ALLOCATION
+	return &console_static.nodes[console_static.node_count++];
+#else
+	return pvPortMalloc(sizeof(ConsoleNode));
+#endif
+}
+
+#if CONFIG_STATIC_ALLOCATION
+static void ConsoleStart(void)
+{
+	ConsoleStatic *mem = &console_static;
+	con_man.port = UsartInitStatic(USART_ID_0, BAUDRATE_9600, mem->rx, 0, mem->tx, CONSOLE_UART_TX_LENGTH);
+	con_man.input = UsartLineInitStatic(con_man.port, mem->lines, CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH);
+#if CONSOLE_USE_LANES
+	con_man.urgent_lock = xSemaphoreCreateBinaryStatic(&mem->urgent_lock);
+	xSemaphoreGive(con_man.urgent_lock);
+	con_man.lanes = UsartLanesInitStatic(con_man.port, mem->tx_high, CONFIG_CONSOLE_TX_HIGH_LENGTH);
+#endif
+	xTaskCreateStatic(ConsoleTask, "Con", CONSOLE_TASK_STACK + CONSOLE_LOG_STACK, NULL, 3, mem->stack, &mem->task);
+#if CONSOLE_USE_RECORDS
+	con_man.log_task = xTaskCreateStatic(ConsoleLogTask, "ConLog", CONSOLE_LOG_TASK_STACK, NULL, 1, mem->log_stack, &mem->log_task);
+#endif
+}
+#else
+static void ConsoleStart(void)
+{
+	con_man.port = UsartInit(USART_ID_0, BAUDRATE_9600, 0, CONSOLE_UART_TX_LENGTH);
+	con_man.input = UsartLineInit(con_man.port, CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH);
+#if CONSOLE_USE_LANES
+	con_man.urgent_lock = xSemaphoreCreateBinary();
+	/* Without the lane errors stay on the locked path, the heap may be short. */
+	if (con_man.urgent_lock != NULL)
+	{
+		xSemaphoreGive(con_man.urgent_lock);
+		con_man.lanes = UsartLanesInit(con_man.port, CONFIG_CONSOLE_TX_HIGH_LENGTH);
+	}
+#endif
+	xTaskCreate(ConsoleTask, "Con", CONSOLE_TASK_STACK + CONSOLE_LOG_STACK, NULL, 3, NULL);
+#if CONSOLE_USE_RECORDS
+	xTaskCreate(ConsoleLogTask, "ConLog", CONSOLE_LOG_TASK_STACK, NULL, 1, &con_man.log_task);
+#endif
+}
+#endif
 
 void ConsoleInit()
 {
+#if CONFIG_STATIC_ALLOCATION
+	con_man.lock = xSemaphoreCreateBinaryStatic(&console_static.lock);
+#else
 	con_man.lock = xSemaphoreCreateBinary();
+#endif
 	xSemaphoreGive(con_man.lock);
 
-	ConsoleNode *node = pvPortMalloc(sizeof(ConsoleNode));
-	node->handler = ConsoleKeyHandler;
-	node->enable_error_log = true;
-	node->enable_info = true;
-	node->enable_warning = true;
-	strcpy(node->key, "CONSOLE");
-	node->pNext = NULL;
-
-	con_man.pHead = node;
-	con_man.con_node = node;
-
-	con_man.enable_error_log = true;
-	con_man.enable_info = true;
-	con_man.enable_warning = true;
-	con_man.port = UsartInit(USART_ID_0, BAUDRATE_9600, 64, 64);
-	xTaskCreate(ConsoleTask, "Con", 164, NULL, 3, NULL);
+	con_man.con_node = ConsoleRegister(ConsoleNodeAlloc(), "CONSOLE", false, ConsoleKeyHandler);
+	ConsoleAddCommands(con_man.con_node, console_commands, sizeof(console_commands) / sizeof(console_commands[0]));
+	for (const ConsoleChannelDef *def = __start_console_channels; def < __stop_console_channels; def++)
+	ConsoleRegister(CONSOLE_READ_PTR(def->node), CONSOLE_READ_PTR(def->key), true, (ConsoleHandler)CONSOLE_READ_PTR(def->handler));
+
+	console_level_mask = CONSOLE_MASK_ALL;
+	con_man.sinks[0] = &console_uart_sink;
+	con_man.sink_count = 1;
+#if CONFIG_CONSOLE_CRASH_LOG
+	ConsoleCrashCheck();
+#endif
+	ConsoleStart();
 }
 
 ConsoleChannel ConsoleCreate(const char *key, ConsoleHandler handler)
 {
-	ConsoleNode *node = pvPortMalloc(sizeof(ConsoleNode));
-	node->handler = handler;
-	strcpy(node->key, key);
-	node->pNext = NULL;
-	node->pNext = con_man.pHead;
-	con_man.pHead = node;
+	ConsoleNode *node = ConsoleRegister(ConsoleNodeAlloc(), key, false, handler);
+#if CONSOLE_USE_WIRE
+	if (node != NULL && con_man.announced)
+	ConsoleAnnounce(node);
+#endif
+	return node;
+}
 
-	node->enable_error_log = true;
-	node->enable_info = true;
-	node->enable_warning = true;
+bool ConsoleAddCommands(ConsoleChannel ch, const ConsoleCommand *commands, uint8_t count)
+{
+	if (ch == NULL)
+	return false;
+	ConsoleNode *node = (ConsoleNode *)ch;
+	node->commands = commands;
+	node->command_count = count;
+	return true;
+}
 
-	return node;
+void ConsoleSetPolicy(ConsoleChannel ch, ConsolePolicy policy)
+{
+	if (ch == NULL)
+	return;
+	((ConsoleNode *)ch)->policy = policy;
 }
 
-void ConsoleSendKey(ConsoleMessageType type, const char *module)
-{	UsartWriteByte(con_man.port, '>');
-	UsartWriteString(con_man.port, module);
-	UsartWriteByte(con_man.port, '[');
-	switch (type)
+/* Take the console lock, counting the callers that had to wait for it. */
+static bool ConsoleLock(TickType_t timeout)
+{
+#if CONFIG_CONSOLE_STATS
+	if (xSemaphoreTake(con_man.lock, 0) != pdFALSE)
+	return true;
+	if (timeout == 0)
+	return false;
+	TickType_t start = xTaskGetTickCount();
+	if (xSemaphoreTake(con_man.lock, timeout) == pdFALSE)
 	{
-		case CONSOLE_MESSAGE_INFO:
-		UsartWriteString(con_man.port, "INFO");
-		break;
-		case CONSOLE_MESSAGE_WARN:
-		UsartWriteString(con_man.port, "WARN");
-		break;
+		con_man.stats.lock_timeouts++;
+		return false;
+	}
+	TickType_t waited = xTaskGetTickCount() - start;
+	ConsoleStats *stats = &con_man.stats;
+	stats->lock_waits++;
+	stats->lock_wait_ticks += waited;
+	CONSOLE_PEAK(stats->lock_wait_max, waited);
+	return true;
+#else
+	return xSemaphoreTake(con_man.lock, timeout) != pdFALSE;
+#endif
+}
 
-		case CONSOLE_MESSAGE_ERROR:
-		UsartWriteString(con_man.port, "ERROR");
-		break;
+ConsoleSink *ConsoleUartSink(void)
+{
+	return &console_uart_sink;
+}
 
-		case CONSOLE_MESSAGE_REPLY:
-		UsartWriteString(con_man.port, "REPLY");
-		break;
+bool ConsoleAddSink(ConsoleSink *sink, uint8_t level_mask)
+{
+	if (sink == NULL || con_man.sink_count >= CONFIG_CONSOLE_MAX_SINKS)
+	return false;
+	sink->level_mask = level_mask;
+#if CONFIG_CONSOLE_FRAMED
+	sink->seq = 0;
+#endif
+	if (ConsoleLock(CONFIG_CONSOLE_BLOCK_TIMEOUT) == false)
+	return false;
+	con_man.sinks[con_man.sink_count++] = sink;
+	xSemaphoreGive(con_man.lock);
+	return true;
+}
 
-		default:
-		break;
+void ConsoleSetSinkLevels(ConsoleSink *sink, uint8_t level_mask)
+{
+	sink->level_mask = level_mask;
+}
+
+/* Pick the sinks for a message of level that takes size bytes on the wire.
+ * A sink without room skips the message and the others still get it, when
+ * blocking it is kept in sink_wait and written after the others. Returns
+ * false when a sink skipped it. The caller holds the console lock. */
+static bool ConsoleSinkSelect(uint8_t level, uint16_t size, bool block)
+{
+	bool fits = true;
+	con_man.sink_select = 0;
+	con_man.sink_wait = 0;
+	for (uint8_t i = 0; i < con_man.sink_count; i++)
+	{
+		ConsoleSink *sink = con_man.sinks[i];
+		if ((sink->level_mask & CONSOLE_MASK(level)) == 0)
+		continue;
+#if CONSOLE_USE_LANES
+		/* ConsoleUrgentWrite already gave it to the UART. */
+		if (i == 0 && level == CONSOLE_LEVEL_ERROR && con_man.lanes)
+		continue;
+#endif
+		if (sink->space == NULL || sink->space(sink) >= size)
+		con_man.sink_select |= (uint8_t)(1 << i);
+		else if (block)
+		con_man.sink_wait |= (uint8_t)(1 << i);
+		else
+		fits = false;
 	}
+	con_man.sink_select |= con_man.sink_wait;
+	return fits;
+}
 
-	UsartWriteByte(con_man.port, ']');
-	UsartWriteByte(con_man.port, ':');
-	UsartWriteByte(con_man.port, ' ');
+static void ConsoleRamSinkWrite(ConsoleSink *sink, const uint8_t *data, uint16_t len)
+{
+	ConsoleRamSink *ram = (ConsoleRamSink *)sink;
+	if (len > ram->size)
+	{
+		data += len - ram->size;
+		len = ram->size;
+	}
+	uint16_t first = ram->size - ram->head;
+	if (first > len)
+	first = len;
+	memcpy(&ram->buf[ram->head], data, first);
+	memcpy(ram->buf, &data[first], len - first);
+	ram->head = (ram->head + len >= ram->size) ? ram->head + len - ram->size : ram->head + len;
+	ram->count = ((uint32_t)ram->count + len > ram->size) ? ram->size : ram->count + len;
 }
 
-void ConsoleError(ConsoleChannel ch, const char *error)
+void ConsoleRamSinkInit(ConsoleRamSink *sink, uint8_t *buf, uint16_t size)
 {
-	if (ch == NULL)
-	return;
-	ConsoleNode *nch = (ConsoleNode *)ch;
-	if (con_man.enable_error_log != true || nch->enable_error_log != true)
+	sink->base.write = ConsoleRamSinkWrite;
+	sink->base.space = NULL;
+	sink->buf = buf;
+	sink->size = size;
+	sink->head = 0;
+	sink->count = 0;
+}
+
+uint16_t ConsoleRamSinkRead(ConsoleRamSink *sink, uint8_t *data, uint16_t len)
+{
+	if (ConsoleLock(CONFIG_CONSOLE_BLOCK_TIMEOUT) == false)
+	return 0;
+	if (len > sink->count)
+	len = sink->count;
+	uint16_t tail = (sink->head >= sink->count) ? sink->head - sink->count : sink->head + sink->size - sink->count;
+	uint16_t first = sink->size - tail;
+	if (first > len)
+	first = len;
+	memcpy(data, &sink->buf[tail], first);
+	memcpy(&data[first], sink->buf, len - first);
+	sink->count -= len;
+	xSemaphoreGive(con_man.lock);
+	return len;
+}
+
+/* Saturating, ISRs count their drops too. */
+static void ConsoleCountDrops(ConsoleNode *node, uint16_t count, bool from_isr)
+{
+	UBaseType_t mask = 0;
+	if (from_isr)
+	mask = taskENTER_CRITICAL_FROM_ISR();
+	else
+	taskENTER_CRITICAL();
+	uint16_t dropped = node->dropped + count;
+	node->dropped = (dropped < count) ? 0xFFFF : dropped;
+	if (from_isr)
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	else
+	taskEXIT_CRITICAL();
+}
+
+static uint16_t ConsoleTakeDrops(ConsoleNode *node)
+{
+	taskENTER_CRITICAL();
+	uint16_t dropped = node->dropped;
+	node->dropped = 0;
+	taskEXIT_CRITICAL();
+	return dropped;
+}
+
+/* Emit the drop summary of a channel, the count is kept when it cannot go out either. */
+static void ConsoleReportDrops(ConsoleNode *node, uint8_t policy)
+{
+	if (node->dropped == 0)
 	return;
-	if (xSemaphoreTake(con_man.lock, 10000) != pdFALSE)
+	uint16_t dropped = ConsoleTakeDrops(node);
+#if CONFIG_CONSOLE_TOKENIZED
+	uint8_t data[CONFIG_CONSOLE_TOKEN_RECORD_LENGTH];
+	uint8_t len = ConsoleTokenize(data, node, CONSOLE_MESSAGE_WARN, CONSOLE_TOKEN("%u messages dropped."), CONSOLE_ARG_UINT, (unsigned int)dropped);
+	if (ConsoleRenderBytes(data, len, policy, CONSOLE_NOW()) == false)
+#else
+	ConsoleArg arg;
+	arg.u = dropped;
+	ConsoleArgs in = CONSOLE_ARGS(&arg, 1);
+	if (ConsoleRender(node, CONSOLE_MESSAGE_WARN, CONSOLE_STR("%u messages dropped."), &in, policy, CONSOLE_NOW()) == false)
+#endif
+	ConsoleCountDrops(node, dropped, false);
+	else
+	CONSOLE_STAT(node->lost += dropped);
+}
+
+#if CONFIG_CONSOLE_COMPRESS
+
+/* Byte k of the match candidate that starts distance bytes back. A match may
+ * run on into the lookahead, as the decoder copies byte by byte. */
+static uint8_t ConsoleLzAt(const ConsoleLz *lz, uint16_t distance, uint8_t k)
+{
+	if (k >= distance)
+	return lz->ahead[k - distance];
+	uint16_t pos = lz->head + CONFIG_CONSOLE_COMPRESS_WINDOW - distance + k;
+	if (pos >= CONFIG_CONSOLE_COMPRESS_WINDOW)
+	pos -= CONFIG_CONSOLE_COMPRESS_WINDOW;
+	return lz->window[pos];
+}
+
+/* Compression is part of the UART sink, the other sinks get plain bytes. */
+static void ConsoleLzWriteGroup(void)
+{
+	UsartWriteLane(con_man.port, USART_LANE_LOW, con_man.lz.group, con_man.lz.group_len);
+	con_man.lz.items = 0;
+}
+
+static void ConsoleLzItem(bool reference, uint8_t first, uint8_t second)
+{
+	ConsoleLz *lz = &con_man.lz;
+	if (lz->items == 0)
 	{
-		ConsoleSendKey(CONSOLE_MESSAGE_ERROR, nch->key);
-		UsartWriteString(con_man.port, error);
-		UsartWriteByte(con_man.port, CONFIG_CONSOLE_LINE_ENDING_CHAR);
-		xSemaphoreGive(con_man.lock);
+		lz->group[0] = 0;
+		lz->group_len = 1;
 	}
+	lz->group[lz->group_len++] = first;
+	if (reference)
+	{
+		lz->group[0] |= 1 << lz->items;
+		lz->group[lz->group_len++] = second;
+	}
+	if (++lz->items == 8)
+	ConsoleLzWriteGroup();
 }
 
-void ConsoleInfo(ConsoleChannel ch, const char *info)
+static ConsoleLzPos *ConsoleLzBucket(ConsoleLz *lz, const uint8_t *bytes)
 {
-	if (ch == NULL)
-	return;
-	ConsoleNode *nch = (ConsoleNode *)ch;
-	if (con_man.enable_info != true || nch->enable_info != true)
-	return;
+	uint16_t key = ((uint16_t)bytes[0] << 8 | bytes[1]) ^ ((uint16_t)bytes[2] << 4);
+	return lz->buckets[(uint16_t)(key * 40503u) / (65536u / CONFIG_CONSOLE_COMPRESS_HASH)];
+}
+
+/* Encode the front of the lookahead as the longest match in the window or as
+ * a literal, and move the encoded bytes into the window. Candidates come from
+ * the hash table and are checked byte by byte, a stale one just fails. */
+static void ConsoleLzStep(void)
+{
+	ConsoleLz *lz = &con_man.lz;
+	uint8_t best_len = 0;
+	uint16_t best_distance = 0;
+	if (lz->ahead_len >= CONSOLE_LZ_MIN_MATCH)
+	{
+		ConsoleLzPos *bucket = ConsoleLzBucket(lz, lz->ahead);
+		for (uint8_t way = 0; way < CONSOLE_LZ_WAYS; way++)
+		{
+			uint16_t distance = (ConsoleLzPos)(lz->count - bucket[way]);
+			if (distance == 0 || distance > lz->filled)
+			continue;
+			uint8_t len = 0;
+			while (len < lz->ahead_len && ConsoleLzAt(lz, distance, len) == lz->ahead[len])
+			len++;
+			if (len > best_len)
+			{
+				best_len = len;
+				best_distance = distance;
+			}
+		}
+	}
 
-	if (xSemaphoreTake(con_man.lock, 10000) != pdFALSE)
+	if (best_len >= CONSOLE_LZ_MIN_MATCH)
+	ConsoleLzItem(true, (uint8_t)best_distance, (uint8_t)(((best_distance >> 8) << 4) | (best_len - CONSOLE_LZ_MIN_MATCH)));
+	else
 	{
-		ConsoleSendKey(CONSOLE_MESSAGE_INFO, nch->key);
-		UsartWriteString(con_man.port, info);
-		UsartWriteByte(con_man.port, CONFIG_CONSOLE_LINE_ENDING_CHAR);
-		xSemaphoreGive(con_man.lock);
+		best_len = 1;
+		ConsoleLzItem(false, lz->ahead[0], 0);
 	}
+
+	for (uint8_t i = 0; i < best_len; i++)
+	{
+		/* Index the position while its 3 bytes are still at hand. */
+		if (i + CONSOLE_LZ_MIN_MATCH <= lz->ahead_len)
+		{
+			ConsoleLzPos *bucket = ConsoleLzBucket(lz, &lz->ahead[i]);
+			for (uint8_t way = CONSOLE_LZ_WAYS - 1; way > 0; way--)
+			bucket[way] = bucket[way - 1];
+			bucket[0] = lz->count;
+		}
+		lz->count++;
+		lz->window[lz->head] = lz->ahead[i];
+		if (++lz->head == CONFIG_CONSOLE_COMPRESS_WINDOW)
+		lz->head = 0;
+		if (lz->filled < CONFIG_CONSOLE_COMPRESS_WINDOW)
+		lz->filled++;
+	}
+	lz->ahead_len -= best_len;
+	memmove(lz->ahead, &lz->ahead[best_len], lz->ahead_len);
 }
 
-void ConsoleWarning(ConsoleChannel ch, const char *warning)
+#endif
+
+/* Every byte of console output goes through here, so the compressor can sit
+ * between the formatter and the port. The caller holds the console lock. */
+static void ConsoleUartWrite(ConsoleSink *sink, const uint8_t *data, uint16_t len)
 {
-	if (ch == NULL)
-	return;
-	ConsoleNode *nch = (ConsoleNode *)ch;
-	if (con_man.enable_warning != true || nch->enable_warning != true)
+#if CONFIG_CONSOLE_COMPRESS
+	ConsoleLz *lz = &con_man.lz;
+	for (uint16_t i = 0; i < len; i++)
+	{
+		lz->ahead[lz->ahead_len++] = data[i];
+		if (lz->ahead_len == CONSOLE_LZ_MAX_MATCH)
+		ConsoleLzStep();
+	}
+#else
+	UsartWriteLane(con_man.port, USART_LANE_LOW, data, len);
+#endif
+}
+
+static uint16_t ConsoleUartSpace(ConsoleSink *sink)
+{
+	return UsartWriteSpace(con_man.port);
+}
+
+/* Hand data to the sinks picked by ConsoleSinkSelect, those with room first
+ * so a full UART does not hold back the others. */
+static void ConsolePut(const uint8_t *data, uint16_t len)
+{
+	uint8_t mask = con_man.sink_select & (uint8_t)~con_man.sink_wait;
+	for (uint8_t pass = 0; pass < 2; pass++, mask = con_man.sink_wait)
+	{
+		for (uint8_t i = 0; i < con_man.sink_count; i++)
+		{
+			if (mask & (1 << i))
+			con_man.sinks[i]->write(con_man.sinks[i], data, len);
+		}
+	}
+}
+
+static void ConsolePutByte(uint8_t c)
+{
+	ConsolePut(&c, 1);
+}
+
+#if CONSOLE_USE_WIRE == 0
+static void ConsolePutString(const char *str)
+{
+	ConsolePut((const uint8_t *)str, strlen(str));
+}
+#endif
+
+#if CONFIG_CONSOLE_FRAMED == 0
+/* End of a message: push out what the compressor still holds, or let the
+ * high lane in. */
+static void ConsoleFlush(void)
+{
+#if CONSOLE_USE_LANES
+	if (con_man.lanes && (con_man.sink_select & 1))
+	UsartEndMessage(con_man.port, USART_LANE_LOW);
+#endif
+#if CONFIG_CONSOLE_COMPRESS
+	ConsoleLz *lz = &con_man.lz;
+	if ((con_man.sink_select & 1) == 0 || (lz->ahead_len == 0 && lz->items == 0))
 	return;
-	if (xSemaphoreTake(con_man.lock, 10000) != pdFALSE)
+	while (lz->ahead_len != 0)
+	ConsoleLzStep();
+	ConsoleLzItem(true, 0, 0);
+	if (lz->items != 0)
+	ConsoleLzWriteGroup();
+#endif
+}
+
+#if CONSOLE_USE_LANES
+/* An error goes to the UART high lane under its own lock, past the lines the
+ * UART still holds and past a lock holder waiting for room. It is written
+ * only once the lane has room for all of it, so a message end never cuts a
+ * line. Returns false when the room did not come in time, at once for
+ * anything but the blocking policy. */
+static bool ConsoleUrgentWrite(const uint8_t *data, uint16_t len, bool block)
+{
+	if ((console_uart_sink.level_mask & CONSOLE_MASK(CONSOLE_LEVEL_ERROR)) == 0)
+	return true;
+	if (xSemaphoreTake(con_man.urgent_lock, block ? CONFIG_CONSOLE_BLOCK_TIMEOUT : 0) == pdFALSE)
+	return false;
+	bool fits = block ? UsartLaneWait(con_man.port, USART_LANE_HIGH, len, CONFIG_CONSOLE_BLOCK_TIMEOUT) : UsartLaneSpace(con_man.port, USART_LANE_HIGH) >= len;
+	/* Only the ISR touches the lane meanwhile, the write takes all of it. */
+	if (fits)
 	{
-		ConsoleSendKey(CONSOLE_MESSAGE_WARN, nch->key);
-		UsartWriteString(con_man.port, warning);
-		UsartWriteByte(con_man.port, CONFIG_CONSOLE_LINE_ENDING_CHAR);
-		xSemaphoreGive(con_man.lock);
+		UsartWriteLane(con_man.port, USART_LANE_HIGH, data, len);
+		UsartEndMessage(con_man.port, USART_LANE_HIGH);
 	}
+	xSemaphoreGive(con_man.urgent_lock);
+	return fits;
+}
+#endif
+
+/* Room a message of len bytes needs in the TX buffer, the compressor may add
+ * a control bit per byte and the flush item. */
+static uint16_t ConsoleWireSize(uint16_t len)
+{
+#if CONFIG_CONSOLE_COMPRESS
+	return len + len / 8 + 4;
+#else
+	return len;
+#endif
 }
+#endif
 
+#if CONFIG_CONSOLE_TOKENIZED == 0
+void ConsoleLog(ConsoleChannel ch, uint8_t level, const char *str)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
+	return;
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+#if CONFIG_CONSOLE_DEFERRED
+	ConsoleRecordSubmit(nch, level, str, 0, NULL, false);
+#else
+	ConsoleEmit(nch, level, str, NULL);
+#endif
+}
+#endif
 
 void ToUpperCase(char * input)
 {
@@ -207,6 +1056,128 @@ void ToUpperCase(char * input)
 	}
 }
 
+typedef struct
+{
+	const char *name;
+	const char *label;
+	uint8_t mask;
+} ConsoleLevelVerb;
+
+static const ConsoleLevelVerb console_levels[] =
+{
+	{ "ERROR", "Error", CONSOLE_MASK(CONSOLE_LEVEL_ERROR) },
+	{ "WARN", "Warning", CONSOLE_MASK(CONSOLE_LEVEL_WARN) },
+	{ "INFO", "Info", CONSOLE_MASK(CONSOLE_LEVEL_INFO) },
+	{ "DEBUG", "Debug", CONSOLE_MASK(CONSOLE_LEVEL_DEBUG) },
+	{ "TRACE", "Trace", CONSOLE_MASK(CONSOLE_LEVEL_TRACE) },
+	{ "ALL", "All", CONSOLE_MASK_ALL }
+};
+
+static uint16_t ConsoleToken(const char *word)
+{
+	size_t len = strlen(word);
+	if (len == 0)
+	return 0;
+	return CONSOLE_VERB(word[0], word[len - 1], len);
+}
+
+static bool ConsoleNameEqual(const char *a, const char *b)
+{
+	for (;; a++, b++)
+	{
+		char ca = (*a >= 'a' && *a <= 'z') ? *a - 32 : *a;
+		char cb = (*b >= 'a' && *b <= 'z') ? *b - 32 : *b;
+		if (ca != cb)
+		return false;
+		if (ca == 0)
+		return true;
+	}
+}
+
+static const ConsoleLevelVerb *ConsoleFindLevel(const char *verb)
+{
+	uint8_t i;
+	switch (ConsoleToken(verb))
+	{
+		case CONSOLE_VERB('E', 'R', 5): i = 0; break;
+		case CONSOLE_VERB('W', 'N', 4): i = 1; break;
+		case CONSOLE_VERB('I', 'O', 4): i = 2; break;
+		case CONSOLE_VERB('D', 'G', 5): i = 3; break;
+		case CONSOLE_VERB('T', 'E', 5): i = 4; break;
+		case CONSOLE_VERB('A', 'L', 3): i = 5; break;
+		default: return NULL;
+	}
+	return ConsoleNameEqual(verb, console_levels[i].name) ? &console_levels[i] : NULL;
+}
+
+static const ConsoleCommand *ConsoleFindCommand(const ConsoleNode *node, const char *verb)
+{
+	for (uint8_t i = 0; i < node->command_count; i++)
+	{
+		if (ConsoleNameEqual(verb, node->commands[i].name))
+		return &node->commands[i];
+	}
+	return NULL;
+}
+
+/* <key> <level> ON|OFF. On the CONSOLE channel it switches the level for all channels. */
+static void ConsoleLevelCommand(ConsoleNode *node, const ConsoleLevelVerb *level, const char *verb, const char *option)
+{
+	bool global = (node == con_man.con_node);
+	volatile uint8_t *mask = global ? &console_level_mask : &node->base.level_mask;
+	uint16_t token = ConsoleToken(option);
+	bool on;
+
+	if (token == CONSOLE_VERB('O', 'N', 2) && ConsoleNameEqual(option, "ON"))
+	on = true;
+	else if (token == CONSOLE_VERB('O', 'F', 3) && ConsoleNameEqual(option, "OFF"))
+	on = false;
+	else
+	{
+		ConsoleReplyf("Unknown option for %s -> %s command.\r\n", node->key, verb);
+		return;
+	}
+
+	if (on)
+	*mask |= level->mask;
+	else
+	*mask &= ~level->mask;
+	if (global)
+	ConsoleReplyf("%s logging turned %s!", level->label, on ? "on" : "off");
+	else
+	ConsoleReplyf("%s log of <%s> turned %s.\r\n", level->label, node->key, on ? "on" : "off");
+}
+
+/* Send the reply buffer as one line of the channel and empty it. */
+static void ConsoleReplySend(ConsoleNode *node)
+{
+	CONSOLE_PEAK(con_man.stats.reply_peak, strlen(con_man.reply));
+#if CONSOLE_USE_WIRE
+	ConsoleSendText(node, CONSOLE_MESSAGE_REPLY, con_man.reply);
+#else
+	char head[20];
+	ConsoleOut out = { head, sizeof(head), 0 };
+	ConsoleFormatKey(&out, CONSOLE_MESSAGE_REPLY, node->key);
+	if (ConsoleLock(1000) != false)
+	{
+		ConsoleSinkSelect(CONSOLE_LEVEL_NONE, 0, true);
+		ConsolePut((const uint8_t *)head, out.pos);
+		ConsolePutString((const char *)con_man.reply);
+		ConsolePutByte(CONFIG_CONSOLE_LINE_ENDING_CHAR);
+		ConsoleFlush();
+		xSemaphoreGive(con_man.lock);
+	}
+#endif
+	memset(con_man.reply, 0, CONFIG_CONSOLE_REPLY_BUFFER_LENGTH);
+	con_man.reply_len = 0;
+}
+
+void ConsoleReplyFlush(void)
+{
+	ConsoleReplySend(con_man.reply_node);
+	con_man.reply_flushed = true;
+}
+
 void HandleInputKey(char *str)
 {
 	char *ptr = str;
@@ -225,239 +1196,155 @@ void HandleInputKey(char *str)
 		}
 	}
 
-	ConsoleNode *node = con_man.pHead;
-	bool flag = 0;
+	ToUpperCase(str);
+	ConsoleNode *node = ConsoleFind(str);
 
-	while (node != NULL)
+	memset(con_man.reply, 0, CONFIG_CONSOLE_REPLY_BUFFER_LENGTH);
+	con_man.reply_len = 0;
+	con_man.reply_node = (node != NULL) ? node : con_man.con_node;
+	con_man.reply_flushed = false;
+	if (node != NULL)
 	{
-		//DebugSendString(node->key);
-		ToUpperCase(str);
-		if (strcmp(node->key, str) == 0)
-		{
-			if (node->handler != NULL)
-			{
-				char temp[10];
-				memset(temp, 0, 10);
-				strncpy(temp, lst[0], 9);
-				ToUpperCase(temp);
-				if (strcmp(temp, "ERROR") == 0)
-				{
-					ToUpperCase(lst[1]);
-					if (strcmp(lst[1], "ON") == 0)
-					{
-						node->enable_error_log = true;
-						strcpy(con_man.reply, "Error log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned on.\r\n");
-					}
-					else if (strcmp(lst[1], "OFF") == 0)
-					{
-						node->enable_error_log = false;
-						strcpy(con_man.reply, "Error log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned off.\r\n");
-					}
-					else
-					{
-						strcpy(con_man.reply, "Unknown option for ");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, " -> ");
-						strcat(con_man.reply, lst[0]);
-						strcat(con_man.reply, " command.\r\n");
-					}
-				}
-				else if (strcmp(temp, "WARN") == 0)
-				{
-					if (strcmp(lst[1], "ON") == 0)
-					{
-						node->enable_warning = true;
-						strcpy(con_man.reply, "Warning log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned on.\r\n");
-					}
-					else if (strcmp(lst[1], "OFF") == 0)
-					{
-						node->enable_warning = false;
-						strcpy(con_man.reply, "Warning log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned off.\r\n");
-					}
-					else
-					{
-						strcpy(con_man.reply, "Unknown option for ");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, " -> ");
-						strcat(con_man.reply, lst[0]);
-						strcat(con_man.reply, " command.\r\n");
-					}
-				}
-				else if (strcmp(temp, "INFO") == 0)
-				{
-					if (strcmp(lst[1], "ON") == 0)
-					{
-						node->enable_info = true;
-						strcpy(con_man.reply, "Info log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned on.\r\n");
-					}
-					else if (strcmp(lst[1], "OFF") == 0)
-					{
-						node->enable_info = false;
-						strcpy(con_man.reply, "Info log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned off.\r\n");
-					}
-					else
-					{
-						strcpy(con_man.reply, "Unknown option for ");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, " -> ");
-						strcat(con_man.reply, lst[0]);
-						strcat(con_man.reply, " command.\r\n");
-					}
-				}
-				else if(strcmp(temp, "ALL") == 0)
-				{
-					if (strcmp(lst[1], "ON") == 0)
-					{
-						node->enable_info = true;
-						node->enable_warning = true;
-						node->enable_error_log = true;
-						strcpy(con_man.reply, "Info, Warning and Error log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned on.\r\n");
-					}
-					else if (strcmp(lst[1], "OFF") == 0)
-					{
-						node->enable_info = false;
-						node->enable_warning = false;
-						node->enable_error_log = false;
-						strcpy(con_man.reply, "Info, Warning and Error log of <");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, "> turned off.\r\n");
-					}
-					else
-					{
-						strcpy(con_man.reply, "Unknown option for ");
-						strcat(con_man.reply, node->key);
-						strcat(con_man.reply, " -> ");
-						strcat(con_man.reply, lst[0]);
-						strcat(con_man.reply, " command.\r\n");
-					}
-				}
-				else
-				{
-					memset(con_man.reply, 0, CONFIG_CONSOLE_REPLY_BUFFER_LENGTH);
-					node->handler((char *)con_man.reply, (const char **)lst, count);
-				}
-
-				flag = true;
-				break;
-			}
-		}
-		node = node->pNext;
+		const char *verb = (count > 0) ? lst[0] : "";
+		const ConsoleLevelVerb *level = ConsoleFindLevel(verb);
+		const ConsoleCommand *command = ConsoleFindCommand(node, verb);
+
+		if (level != NULL)
+		ConsoleLevelCommand(node, level, verb, (count > 1) ? lst[1] : "");
+		else if (command != NULL)
+		command->handler((char *)con_man.reply, (const char **)lst, count);
+		else if (node->handler != NULL)
+		node->handler((char *)con_man.reply, (const char **)lst, count);
+		else
+		ConsoleReplyf("Unknown command <%s>.\r\n", verb);
 	}
+	else
+	ConsoleReplyf("Command module not registered or Not implemented.\r\n");
 
-	if (flag == false)
-	strcpy((char *)con_man.reply, "Command module not registered or Not implemented.\r\n");
-
-	if (xSemaphoreTake(con_man.lock, 1000) != pdFALSE)
-	{
-		if (node == NULL)
-		{
-			node = con_man.con_node;
-		}
-		ConsoleSendKey(CONSOLE_MESSAGE_REPLY, node->key); 
-		UsartWriteString(con_man.port, (const char *)con_man.reply);
-		UsartWriteByte(con_man.port, CONFIG_CONSOLE_LINE_ENDING_CHAR);
-		xSemaphoreGive(con_man.lock);
-	}
+	/* A handler that flushed its lines leaves no empty one behind. */
+	if (con_man.reply[0] != 0 || con_man.reply_flushed == false)
+	ConsoleReplySend(con_man.reply_node);
 }
 
 void ConsoleTask(void *param)
 {
+#if CONSOLE_USE_WIRE
+	con_man.announced = true;
+	for (uint8_t i = 0; i < con_man.channel_count; i++)
+	ConsoleAnnounce(con_man.channels[i]);
+#endif
+#if CONFIG_CONSOLE_CRASH_LOG && CONSOLE_USE_RECORDS == 0
+	ConsoleCrashReplay();
+#endif
+	/* The UART interrupt assembles the lines, the task only wakes for a
+	 * complete one. A line longer than the buffer is dropped as a whole. */
+	if (con_man.input == false)
+	ConsoleError(con_man.con_node, "No memory for the command lines, commands are off.");
+	bool cut = false;
 	while (true)
 	{
-		uint8_t data = 0;
-		if (UsartReadByte(con_man.port, &data) != false)
+		uint16_t len = 0;
+		char *line = UsartReadLine(con_man.port, &len);
+		if (line == NULL)
 		{
-			if (data == '\n')
-			{
-				if (con_man.index != 0)
-				{
-					HandleInputKey((char *)con_man.buffer);
-					memset(con_man.buffer, 0, CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH);
-					con_man.index = 0;
-				}
-			}
-			else
-			{
-				con_man.buffer[con_man.index++] = data;
-				if (con_man.index >= CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH)
-				{
-					memset(con_man.buffer, 0, CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH);
-					con_man.index = 0;
-				}
-			}
+			vTaskDelay(1000);
+			continue;
 		}
+		bool skip = cut;
+		cut = (line[len - 1] != '\n');
+		if (skip || cut)
+		continue;
+		line[--len] = 0;
+		if (len != 0)
+		HandleInputKey(line);
 	}
 }
 
 void ConsoleKeyHandler(char *reply, const char **param, uint16_t count)
 {
-	if (count == 2)
+	ConsoleReplyf("Unknown command <%s>.", (count > 0) ? param[0] : "");
+}
+
+/* CONSOLE CHANNELS: list the keys, and announce them again on a binary wire. */
+#if CONFIG_CONSOLE_STATS
+#if CONFIG_CONSOLE_TOKENIZED
+#define CONSOLE_LINE_LIMIT	CONFIG_CONSOLE_TOKEN_RECORD_LENGTH
+#else
+#define CONSOLE_LINE_LIMIT	(CONFIG_CONSOLE_LINE_LENGTH - 1)
+#endif
+
+/* One reply line per counter group, then one per channel. Peaks are shown
+ * against the size they have to fit. */
+static void ConsoleStatsCommand(char *reply, const char **param, uint16_t count)
+{
+	const ConsoleStats *stats = &con_man.stats;
+	UsartStats uart;
+	if (UsartGetStats(con_man.port, &uart))
 	{
-		if (strcmp(param[0], "ERROR") == 0)
-		{
-			if (strcmp(param[1], "ON") == 0)
-			{
-				con_man.enable_error_log = true;
-				strcpy(reply, "Error logging turned on!");
-			}
-			else if (strcmp(param[1], "OFF") == 0)
-			{
-				con_man.enable_error_log = false;
-				strcpy(reply, "Error logging turned off!");
-			}
-			else
-			{
-				strcpy(reply, "Unknown error log setting!");
-			}
-		}
-		else if (strcmp(param[0], "WARN") == 0)
-		{
-			if (strcmp(param[1], "ON") == 0)
-			{
-				con_man.enable_warning = true;
-				strcpy(reply, "Warning logging turned on!");
-			}
-			else if (strcmp(param[1], "OFF") == 0)
-			{
-				con_man.enable_warning = false;
-				strcpy(reply, "Warning logging turned off!");
-			}
-			else
-			{
-				strcpy(reply, "Unknown error log setting!");
-			}
-		}
-		else if (strcmp(param[0], "INFO") == 0)
-		{
-			if (strcmp(param[1], "ON") == 0)
-			{
-				con_man.enable_info = true;
-				strcpy(reply, "Info logging turned on!");
-			}
-			else if (strcmp(param[1], "OFF") == 0)
-			{
-				con_man.enable_info = false;
-				strcpy(reply, "Info logging turned off!");
-			}
-			else
-			{
-				strcpy(reply, "Unknown info log setting!");
-			}
-		}
+		ConsoleReplyf("uart tx %lu rx %lu overruns %u", (unsigned long)uart.tx_bytes, (unsigned long)uart.rx_bytes, uart.rx_overruns);
+		ConsoleReplyFlush();
+		ConsoleReplyf("uart peak tx %u/%u line %u/%u", uart.tx_peak, CONSOLE_UART_TX_LENGTH, uart.rx_peak, CONFIG_CONSOLE_COMMAND_BUFFER_LENGTH);
+		ConsoleReplyf(" full %u", uart.tx_waits);
+#if CONSOLE_USE_LANES
+		if (con_man.lanes)
+		ConsoleReplyf(" high %u/%u", uart.tx_high_peak, CONFIG_CONSOLE_TX_HIGH_LENGTH);
+#endif
+		ConsoleReplyFlush();
+	}
+	ConsoleReplyf("lock waits %u ticks %lu max %u timeouts %u", stats->lock_waits, (unsigned long)stats->lock_wait_ticks, stats->lock_wait_max, stats->lock_timeouts);
+	ConsoleReplyFlush();
+	ConsoleReplyf("peak line %u/%u reply %u/%u", stats->line_peak, CONSOLE_LINE_LIMIT, stats->reply_peak, CONFIG_CONSOLE_REPLY_BUFFER_LENGTH - 1);
+#if CONSOLE_USE_RECORDS
+	ConsoleReplyf(" queue %u/%u", stats->queue_peak, CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH - 1);
+#endif
+	ConsoleReplyFlush();
+	for (uint8_t i = 0; i < con_man.channel_count; i++)
+	{
+		const ConsoleNode *node = con_man.channels[i];
+		ConsoleReplyf("%s logged %u lost %u", node->key, node->logged, node->lost + node->dropped);
+		ConsoleReplyFlush();
+	}
+}
+#endif
+
+#if CONFIG_CONSOLE_TASKS
+/* One reply line per task: share of the CPU since boot and the least stack
+ * it ever had left, in words. Then the heap. The status table is static, only
+ * the console task runs commands. */
+static void ConsoleTasksCommand(char *reply, const char **param, uint16_t count)
+{
+	static TaskStatus_t tasks[CONFIG_CONSOLE_TASKS_MAX];
+	uint32_t total = 0;
+	UBaseType_t n = uxTaskGetSystemState(tasks, CONFIG_CONSOLE_TASKS_MAX, &total);
+	if (n == 0)
+	{
+		ConsoleReplyf("More than %u tasks.", CONFIG_CONSOLE_TASKS_MAX);
+		return;
+	}
+	total /= 100;
+	for (UBaseType_t i = 0; i < n; i++)
+	{
+		unsigned long percent = (total != 0) ? tasks[i].ulRunTimeCounter / total : 0;
+		ConsoleReplyf("%-8s %3lu%% stack %u", tasks[i].pcTaskName, percent, (unsigned int)tasks[i].usStackHighWaterMark);
+		ConsoleReplyFlush();
+	}
+#if configSUPPORT_DYNAMIC_ALLOCATION
+	ConsoleReplyf("heap free %u min %u", (unsigned int)xPortGetFreeHeapSize(), (unsigned int)xPortGetMinimumEverFreeHeapSize());
+#endif
+}
+#endif
+
+static void ConsoleChannelsCommand(char *reply, const char **param, uint16_t count)
+{
+	bool full = false;
+	for (uint8_t i = 0; i < con_man.channel_count; i++)
+	{
+		ConsoleNode *node = con_man.channels[i];
+#if CONSOLE_USE_WIRE
+		ConsoleAnnounce(node);
+#endif
+		if (full == false)
+		full = (ConsoleReplyf("%s ", node->key) == false);
 	}
 }
 
@@ -467,12 +1354,15 @@ void ConsoleKeyHandler(char *reply, const char **param, uint16_t count)
 #define PAD_RIGHT 1
 #define PAD_ZERO 2
 
-static void printchar(char **out, unsigned int c)
+static void printchar(ConsoleOut *out, unsigned int c)
 {
-	UsartWriteByte(con_man.port, (uint8_t)c);
+	if (out == NULL)
+	ConsolePutByte((uint8_t)c);
+	else if (out->pos + 1 < out->len)
+	out->buf[out->pos++] = (char)c;
 }
 
-static int prints(char **out, const char *string, int width, int pad)
+static int prints(ConsoleOut *out, const char *string, int width, int pad)
 {
 	register int pc = 0, padchar = ' ';
 
@@ -511,40 +1401,176 @@ static int prints(char **out, const char *string, int width, int pad)
 	return pc;
 }
 
-/* the following should be enough for 32 bit int */
-#define PRINT_BUF_LEN 12
+/* Sign, 20 digits of a 64 bit value, point and 9 decimals. */
+#define PRINT_BUF_LEN 34
 
-static int printi(char **out, int i, int b, int sg, int width, int pad, int letbase)
+#define PRINT_LONG	1
+#define PRINT_LLONG	2
+#define PRINT_SIZE	3
+
+static const char console_hex_digits[] CONSOLE_FLASH_DATA = "0123456789abcdef0123456789ABCDEF";
+
+#if defined(__AVR__) || CONFIG_CONSOLE_PRINT_FLOAT
+/* Powers of ten from the largest that fits a ConsoleUint down to 10. */
+static const ConsoleUint console_pow10[] CONSOLE_FLASH_DATA =
+{
+#if CONSOLE_UINT_MAX > 0xFFFFFFFFUL
+	10000000000000000000ULL, 1000000000000000000ULL, 100000000000000000ULL, 10000000000000000ULL,
+	1000000000000000ULL, 100000000000000ULL, 10000000000000ULL, 1000000000000ULL, 100000000000ULL,
+	10000000000ULL,
+#endif
+	1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL, 10000UL, 1000UL, 100UL, 10UL
+};
+
+#define CONSOLE_POW10_COUNT	(sizeof(console_pow10) / sizeof(console_pow10[0]))
+
+/* 10^exp, 1 <= exp <= CONSOLE_POW10_COUNT. */
+static ConsoleUint ConsolePow10(uint8_t exp)
+{
+	const ConsoleUint *p = &console_pow10[CONSOLE_POW10_COUNT - exp];
+#if defined(__AVR__)
+	ConsoleUint value;
+	memcpy_P(&value, p, sizeof(value));
+	return value;
+#else
+	return *p;
+#endif
+}
+#endif
+
+#if defined(__AVR__)
+/* AVR has no divide instruction, a 32 bit division is a library call of
+ * hundreds of cycles. Each digit counts how often its power of ten can be
+ * subtracted instead. Writes the digits of u in front of end, returns the
+ * first one. */
+static char *ConsoleDecimal(char *end, ConsoleUint u)
+{
+	uint8_t exp = CONSOLE_POW10_COUNT;
+
+	while (exp > 0 && u < ConsolePow10(exp))
+	--exp;
+	char *s = end - exp - 1;
+	char *first = s;
+	for (; exp > 0; --exp)
+	{
+		ConsoleUint p = ConsolePow10(exp);
+		char d = '0';
+		while (u >= p)
+		{
+			u -= p;
+			++d;
+		}
+		*s++ = d;
+	}
+	*s = (char)('0' + u);
+	return first;
+}
+#else
+static const char console_digit_pairs[200] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* Division by the constant 100 compiles to a multiply, two digits a step.
+ * Writes the digits of u in front of end, returns the first one. */
+static char *ConsoleDecimal(char *end, ConsoleUint u)
+{
+	char *s = end;
+
+	while (u >= 100)
+	{
+		const char *pair = &console_digit_pairs[(u % 100) * 2];
+		u /= 100;
+		*--s = pair[1];
+		*--s = pair[0];
+	}
+	if (u >= 10)
+	{
+		*--s = console_digit_pairs[u * 2 + 1];
+		*--s = console_digit_pairs[u * 2];
+	}
+	else
+	{
+		*--s = (char)('0' + u);
+	}
+	return s;
+}
+#endif
+
+static int printi(ConsoleOut *out, ConsoleUint u, bool neg, uint8_t base, int width, int pad, bool upper)
 {
 	char print_buf[PRINT_BUF_LEN];
 	register char *s;
-	register int t, neg = 0, pc = 0;
-	register unsigned int u = i;
+	register int pc = 0;
 
-	if (i == 0)
+	s = print_buf + PRINT_BUF_LEN - 1;
+	*s = '\0';
+	if (base == 16)
 	{
-		print_buf[0] = '0';
-		print_buf[1] = '\0';
-		return prints(out, print_buf, width, pad);
+		const char *digits = upper ? &console_hex_digits[16] : console_hex_digits;
+		do
+		{
+			*--s = CONSOLE_READ_BYTE(&digits[u & 0xF], true);
+			u >>= 4;
+		} while (u);
+	}
+	else
+	{
+		s = ConsoleDecimal(s, neg ? -u : u);
 	}
 
-	if (sg && b == 10 && i < 0)
+	if (neg)
 	{
-		neg = 1;
-		u = -i;
+		if (width && (pad & PAD_ZERO))
+		{
+			printchar(out, '-');
+			++pc;
+			--width;
+		}
+		else
+		{
+			*--s = '-';
+		}
+	}
+
+	return pc + prints(out, s, width, pad);
+}
+
+#if CONFIG_CONSOLE_PRINT_FLOAT
+/* Fixed point: the integer part must fit a ConsoleUint, the decimals are
+ * rounded half away from zero to prec digits and printed as an integer too. */
+static int printfloat(ConsoleOut *out, double v, uint8_t prec, int width, int pad)
+{
+	char print_buf[PRINT_BUF_LEN];
+	register char *s;
+	register int pc = 0;
+	bool neg = v < 0;
+
+	if (v != v)
+	return prints(out, "nan", width, pad & ~PAD_ZERO);
+	if (neg)
+	v = -v;
+	if (v >= (double)CONSOLE_UINT_MAX)
+	return prints(out, (v - v == 0) ? "ovf" : "inf", width, pad & ~PAD_ZERO);
+
+	ConsoleUint ip = (ConsoleUint)v;
+	ConsoleUint scale = (prec > 0) ? ConsolePow10(prec) : 1;
+	ConsoleUint fp = (ConsoleUint)((v - (double)ip) * (double)scale + 0.5);
+	if (fp >= scale)
+	{
+		fp -= scale;
+		++ip;
 	}
 
 	s = print_buf + PRINT_BUF_LEN - 1;
 	*s = '\0';
-
-	while (u)
+	if (prec > 0)
 	{
-		t = u % b;
-		if (t >= 10)
-		t += letbase - '0' - 10;
-		*--s = t + '0';
-		u /= b;
+		/* scale + fp keeps the leading zeros, its leading 1 becomes the point. */
+		s = ConsoleDecimal(s, scale + fp);
+		*s = '.';
 	}
+	s = ConsoleDecimal(s, ip);
 
 	if (neg)
 	{
@@ -562,68 +1588,184 @@ static int printi(char **out, int i, int b, int sg, int width, int pad, int letb
 
 	return pc + prints(out, s, width, pad);
 }
+#endif
+
+/* Read the argument of conversion conv with its promoted type, then widen
+ * it. size is the length modifier. */
+static ConsoleArg ConsoleVaArg(va_list *ap, char conv, uint8_t size)
+{
+	ConsoleArg arg;
+	switch (conv)
+	{
+		case 's':
+		arg.s = va_arg(*ap, const char *);
+		break;
+		case 'p':
+		arg.u = (uintptr_t)va_arg(*ap, void *);
+		break;
+		case 'd':
+		case 'i':
+		if (size == PRINT_LLONG)
+		arg.u = (ConsoleUint)(ConsoleInt)va_arg(*ap, long long);
+		else if (size == PRINT_LONG)
+		arg.u = (ConsoleUint)(ConsoleInt)va_arg(*ap, long);
+		else if (size == PRINT_SIZE)
+		arg.u = (ConsoleUint)(ConsoleInt)(ptrdiff_t)va_arg(*ap, size_t);
+		else
+		/* char and short are converted to int then pushed on the stack */
+		arg.u = (ConsoleUint)(ConsoleInt)va_arg(*ap, int);
+		break;
+		case 'f':
+		/* float is converted to double as well */
+		arg.f = va_arg(*ap, double);
+		break;
+		default:
+		if (size == PRINT_LLONG)
+		arg.u = (ConsoleUint)va_arg(*ap, unsigned long long);
+		else if (size == PRINT_LONG)
+		arg.u = va_arg(*ap, unsigned long);
+		else if (size == PRINT_SIZE)
+		arg.u = va_arg(*ap, size_t);
+		else
+		arg.u = va_arg(*ap, unsigned int);
+		break;
+	}
+	return arg;
+}
 
-static int print(char **out, const char *format, va_list args)
+static bool ConsoleIsConversion(char c)
+{
+	return c != '\0' && strchr("spdixXucf", c) != NULL;
+}
+
+/* A packed argument keeps the width of its C type, cut it to the type the
+ * conversion reads, as va_arg would have. */
+static ConsoleArg ConsoleNextArg(ConsoleArgs *in, char conv, uint8_t size)
+{
+	ConsoleArg arg = { 0 };
+	if (in->ap != NULL)
+	return ConsoleVaArg(in->ap, conv, size);
+	if (in->args < in->end)
+	arg = *in->args++;
+	if (conv == 'd' || conv == 'i')
+	{
+		if (size == 0)
+		arg.u = (ConsoleUint)(ConsoleInt)(int)arg.u;
+		else if (size == PRINT_LONG)
+		arg.u = (ConsoleUint)(ConsoleInt)(long)arg.u;
+		else if (size == PRINT_SIZE)
+		arg.u = (ConsoleUint)(ConsoleInt)(ptrdiff_t)arg.u;
+	}
+	else if (conv == 'x' || conv == 'X' || conv == 'u' || conv == 'c')
+	{
+		if (size == 0)
+		arg.u = (unsigned int)arg.u;
+		else if (size == PRINT_LONG)
+		arg.u = (unsigned long)arg.u;
+		else if (size == PRINT_SIZE)
+		arg.u = (size_t)arg.u;
+	}
+	return arg;
+}
+
+static int print(ConsoleOut *out, const char *format, bool flash, ConsoleArgs *in)
 {
 	register int width, pad;
 	register int pc = 0;
+	uint8_t prec;
+	uint8_t size;
 	char scr[2];
+	char c;
 
-	for (; *format != 0; ++format)
+	for (; (c = CONSOLE_READ_BYTE(format, flash)) != 0; ++format)
 	{
-		if (*format == '%')
+		if (c == '%')
 		{
-			++format;
+			c = CONSOLE_READ_BYTE(++format, flash);
 			width = pad = 0;
-			if (*format == '\0')
+			prec = CONFIG_CONSOLE_FLOAT_PRECISION;
+			if (c == '\0')
 			break;
-			if (*format == '%')
+			if (c == '%')
 			goto out;
-			if (*format == '-')
+			if (c == '-')
 			{
-				++format;
+				c = CONSOLE_READ_BYTE(++format, flash);
 				pad = PAD_RIGHT;
 			}
-			while (*format == '0')
+			while (c == '0')
 			{
-				++format;
+				c = CONSOLE_READ_BYTE(++format, flash);
 				pad |= PAD_ZERO;
 			}
-			for (; *format >= '0' && *format <= '9'; ++format)
+			for (; c >= '0' && c <= '9'; c = CONSOLE_READ_BYTE(++format, flash))
 			{
 				width *= 10;
-				width += *format - '0';
+				width += c - '0';
+			}
+			if (c == '.')
+			{
+				prec = 0;
+				for (c = CONSOLE_READ_BYTE(++format, flash); c >= '0' && c <= '9'; c = CONSOLE_READ_BYTE(++format, flash))
+				prec = prec * 10 + (c - '0');
+				if (prec > 9)
+				prec = 9;
 			}
-			if (*format == 's')
+			for (size = 0; c == 'l' || c == 'z' || c == 'h'; c = CONSOLE_READ_BYTE(++format, flash))
 			{
-				register char *s = (char *)va_arg(args, int);
+				if (c == 'z')
+				size = PRINT_SIZE;
+				else if (c == 'l')
+				++size;
+			}
+			if (ConsoleIsConversion(c) == false)
+			continue;
+			ConsoleArg arg = ConsoleNextArg(in, c, size);
+			if (c == 's')
+			{
+				register const char *s = arg.s;
 				pc += prints(out, s ? s : "(null)", width, pad);
 				continue;
 			}
-			if (*format == 'd')
+			if (c == 'd' || c == 'i')
+			{
+				pc += printi(out, arg.u, (ConsoleInt)arg.u < 0, 10, width, pad, false);
+				continue;
+			}
+			if (c == 'x')
 			{
-				pc += printi(out, va_arg(args, int), 10, 1, width, pad, 'a');
+				pc += printi(out, arg.u, false, 16, width, pad, false);
 				continue;
 			}
-			if (*format == 'x')
+			if (c == 'X')
 			{
-				pc += printi(out, va_arg(args, int), 16, 0, width, pad, 'a');
+				pc += printi(out, arg.u, false, 16, width, pad, true);
 				continue;
 			}
-			if (*format == 'X')
+			if (c == 'u')
 			{
-				pc += printi(out, va_arg(args, int), 16, 0, width, pad, 'A');
+				pc += printi(out, arg.u, false, 10, width, pad, false);
 				continue;
 			}
-			if (*format == 'u')
+			if (c == 'p')
 			{
-				pc += printi(out, va_arg(args, int), 10, 0, width, pad, 'a');
+				printchar(out, '0');
+				printchar(out, 'x');
+				pc += 2 + printi(out, arg.u, false, 16, (width > 2) ? width - 2 : 0, pad, false);
 				continue;
 			}
-			if (*format == 'c')
+			if (c == 'f')
 			{
-				/* char are converted to int then pushed on the stack */
-				scr[0] = (char)va_arg(args, int);
+#if CONFIG_CONSOLE_PRINT_FLOAT
+				pc += printfloat(out, arg.f, prec, width, pad);
+#else
+				pc += prints(out, "?", width, pad & ~PAD_ZERO);
+#endif
+				continue;
+			}
+			if (c == 'c')
+			{
+				scr[0] = (char)arg.u;
 				scr[1] = '\0';
 				pc += prints(out, scr, width, pad);
 				continue;
@@ -632,80 +1774,1208 @@ static int print(char **out, const char *format, va_list args)
 		else
 		{
 			out:
-			printchar(out, *format);
+			printchar(out, c);
 			++pc;
 		}
 	}
-	if (out)
-	**out = '\0';
-	va_end(args);
+	/* A zero length buffer, e.g. NULL to size the output, gets no terminator. */
+	if (out && out->len > 0)
+	out->buf[out->pos] = '\0';
 	return pc;
 }
 
+#if CONFIG_CONSOLE_TOKENIZED == 0 && (CONSOLE_USE_RECORDS || CONFIG_CONSOLE_CRASH_LOG)
+/* Copy the arguments referenced by format out of the va_list, so the
+ * message can be rendered later without the caller's stack frame. Only the
+ * first CONFIG_CONSOLE_MAX_ARGS are kept. */
+static uint8_t ConsolePackArgs(ConsoleArg *args, const char *format, bool flash, va_list *ap)
+{
+	uint8_t count = 0;
+	uint8_t size;
+	char c;
+
+	for (; (c = CONSOLE_READ_BYTE(format, flash)) != 0 && count < CONFIG_CONSOLE_MAX_ARGS; ++format)
+	{
+		if (c != '%')
+		continue;
+		c = CONSOLE_READ_BYTE(++format, flash);
+		if (c == '%')
+		continue;
+		while (c == '-' || c == '.' || (c >= '0' && c <= '9'))
+		c = CONSOLE_READ_BYTE(++format, flash);
+		for (size = 0; c == 'l' || c == 'z' || c == 'h'; c = CONSOLE_READ_BYTE(++format, flash))
+		{
+			if (c == 'z')
+			size = PRINT_SIZE;
+			else if (c == 'l')
+			++size;
+		}
+		if (c == '\0')
+		break;
+		if (ConsoleIsConversion(c))
+		args[count++] = ConsoleVaArg(ap, c, size);
+	}
+	return count;
+}
+#endif
+
+/* Formatted straight from the va_list, any number of arguments. */
 int printf(const char *format, ...)
 {
 	va_list args;
+	ConsoleArgs in = { &args, NULL, NULL };
 
+#if CONFIG_CONSOLE_FRAMED
+	/* A reply frame of the console channel, raw bytes would break the frame
+	 * the decoder is in. */
+	char line[CONFIG_CONSOLE_LINE_LENGTH];
+	ConsoleOut out = { line, sizeof(line), 0 };
+	va_start(args, format);
+	int len = print(&out, format, false, &in);
+	va_end(args);
+	ConsoleSendText(con_man.con_node, CONSOLE_MESSAGE_REPLY, line);
+	return len;
+#else
+	/* The sink selection and compressor state belong to the lock holder. */
+	if (ConsoleLock(CONFIG_CONSOLE_BLOCK_TIMEOUT) == false)
+	return 0;
 	va_start(args, format);
-	return print(0, format, args);
+	ConsoleSinkSelect(CONSOLE_LEVEL_NONE, 0, true);
+	int len = print(0, format, false, &in);
+	ConsoleFlush();
+	xSemaphoreGive(con_man.lock);
+	va_end(args);
+	return len;
+#endif
 }
 
-// Below code is based on formatted output code from internet
+int ConsoleFormat(char *buf, uint16_t len, const char *format, ...)
+{
+	va_list args;
+	ConsoleArgs in = { &args, NULL, NULL };
+	ConsoleOut out = { buf, len, 0 };
 
-void ConsoleInfof(ConsoleChannel ch, const char *format, ...)
+	va_start(args, format);
+	int ret = print(&out, format, true, &in);
+	va_end(args);
+	return ret;
+}
+
+/* Appends at the tracked length, so a handler can build its reply piece by
+ * piece without rescanning it. */
+bool ConsoleReplyFormat(const char *format, ...)
 {
+	va_list args;
+	ConsoleArgs in = { &args, NULL, NULL };
+	ConsoleOut out = { &con_man.reply[con_man.reply_len], CONFIG_CONSOLE_REPLY_BUFFER_LENGTH - con_man.reply_len, 0 };
 
-	if (ch == NULL)
+	va_start(args, format);
+	int len = print(&out, format, true, &in);
+	va_end(args);
+	con_man.reply_len += out.pos;
+	return len == out.pos;
+}
+
+#if CONFIG_CONSOLE_FRAMED || CONFIG_CONSOLE_CRASH_LOG
+
+/* CRC-16/CCITT-FALSE, one nibble at a time. */
+static const uint16_t console_crc_table[16] =
+{
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static uint16_t ConsoleCrc16(uint16_t crc, uint8_t c)
+{
+	crc = (crc << 4) ^ console_crc_table[(crc >> 12) ^ (c >> 4)];
+	crc = (crc << 4) ^ console_crc_table[(crc >> 12) ^ (c & 0x0F)];
+	return crc;
+}
+
+#endif
+
+#if CONFIG_CONSOLE_CRASH_LOG
+
+static ConsoleCrashLog console_crash __attribute__((section(".noinit")));
+static uint16_t console_crash_build;
+
+/* End of the code and flash data, from the linker script. */
+extern const char _etext[] __attribute__((weak));
+
+static uint16_t ConsoleCrashCrcBytes(uint16_t crc, const void *data, uint16_t len)
+{
+	const uint8_t *bytes = data;
+	while (len-- > 0)
+	crc = ConsoleCrc16(crc, *bytes++);
+	return crc;
+}
+
+/* Where the code ends and where this file landed in it, a reflash that
+ * changes the firmware moves at least one of them. */
+static uint16_t ConsoleCrashBuild(void)
+{
+	uintptr_t build[2] = { (uintptr_t)_etext, (uintptr_t)&ConsoleCrashReplay };
+	return ConsoleCrashCrcBytes(0xFFFF, build, sizeof(build));
+}
+
+/* Everything after the crc field, padding included: entries are built zeroed
+ * and copied whole. */
+static uint16_t ConsoleCrashEntryCrc(const ConsoleCrashEntry *entry)
+{
+	return ConsoleCrashCrcBytes(console_crash_build, (const uint8_t *)entry + sizeof(entry->crc), sizeof(*entry) - sizeof(entry->crc));
+}
+
+static uint16_t ConsoleCrashCrc(void)
+{
+	uint16_t crc = console_crash_build;
+	crc = ConsoleCrc16(crc, console_crash.magic & 0xFF);
+	crc = ConsoleCrc16(crc, console_crash.magic >> 8);
+	crc = ConsoleCrc16(crc, console_crash.head);
+	return ConsoleCrc16(crc, console_crash.count);
+}
+
+static void ConsoleCrashReset(void)
+{
+	console_crash.magic = CONSOLE_CRASH_MAGIC;
+	console_crash.head = 0;
+	console_crash.count = 0;
+	console_crash.crc = ConsoleCrashCrc();
+}
+
+/* Keep a valid log for the console task to print, start a new one otherwise. */
+static void ConsoleCrashCheck(void)
+{
+	console_crash_build = ConsoleCrashBuild();
+	bool valid = (console_crash.magic == CONSOLE_CRASH_MAGIC && console_crash.crc == ConsoleCrashCrc());
+	if (valid == false || console_crash.head >= CONFIG_CONSOLE_CRASH_LOG_LENGTH || console_crash.count > CONFIG_CONSOLE_CRASH_LOG_LENGTH)
+	ConsoleCrashReset();
+	con_man.crash_armed = (console_crash.count == 0);
+}
+
+/* Seal an entry built by the caller and store it at head. */
+static void ConsoleCrashStore(ConsoleCrashEntry *entry, bool from_isr)
+{
+	UBaseType_t mask = 0;
+	entry->crc = ConsoleCrashEntryCrc(entry);
+	if (from_isr)
+	mask = taskENTER_CRITICAL_FROM_ISR();
+	else
+	taskENTER_CRITICAL();
+	console_crash.entries[console_crash.head] = *entry;
+	uint8_t head = console_crash.head + 1;
+	console_crash.head = (head < CONFIG_CONSOLE_CRASH_LOG_LENGTH) ? head : 0;
+	if (console_crash.count < CONFIG_CONSOLE_CRASH_LOG_LENGTH)
+	console_crash.count++;
+	console_crash.crc = ConsoleCrashCrc();
+	if (from_isr)
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	else
+	taskEXIT_CRITICAL();
+}
+
+#if CONFIG_CONSOLE_TOKENIZED
+
+/* A copy of the encoded record, no formatting. */
+static void ConsoleCrashSave(const uint8_t *data, uint8_t len, TickType_t tick, bool from_isr)
+{
+	if (con_man.crash_armed == false)
 	return;
-	ConsoleNode *nch = (ConsoleNode *)ch;
-	if (con_man.enable_info != true || nch->enable_info != true)
+	ConsoleCrashEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.len = len;
+	memcpy(entry.data, data, len);
+#if CONFIG_CONSOLE_FRAMED
+	entry.tick = tick;
+#else
+	(void)tick;
+#endif
+	ConsoleCrashStore(&entry, from_isr);
+}
+
+static void ConsoleCrashPrint(const ConsoleCrashEntry *entry)
+{
+	if (entry->crc != ConsoleCrashEntryCrc(entry))
 	return;
-	if (xSemaphoreTake(con_man.lock, 10000) != pdFALSE)
+	if (entry->len < CONSOLE_WIRE_HEADER || entry->len > CONFIG_CONSOLE_TOKEN_RECORD_LENGTH || entry->data[0] != CONSOLE_WIRE_START)
+	return;
+	ConsoleRenderBytes(entry->data, entry->len, CONSOLE_POLICY_BLOCK, CONSOLE_RECORD_TICK(*entry));
+}
+
+#else
+
+/* Format and arguments as the deferred record holds them, no formatting. */
+static void ConsoleCrashSave(const ConsoleNode *node, uint8_t type, const char *format, const ConsoleArg *args, uint8_t argc, TickType_t tick, bool from_isr)
+{
+	if (con_man.crash_armed == false)
+	return;
+	ConsoleCrashEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.format = format;
+	entry.channel = node->index;
+	entry.type = type;
+	entry.argc = argc;
+	if (argc != CONSOLE_RECORD_LITERAL)
+	memcpy(entry.args, args, argc * sizeof(ConsoleArg));
+#if CONFIG_CONSOLE_FRAMED
+	entry.tick = tick;
+#else
+	(void)tick;
+#endif
+	ConsoleCrashStore(&entry, from_isr);
+}
+
+/* String arguments pointed into the RAM of the last run, print them as "?". */
+static void ConsoleCrashStrings(const char *format, ConsoleArg *args, uint8_t argc)
+{
+	uint8_t i = 0;
+	char c;
+	while (i < argc && (c = CONSOLE_READ_BYTE(format++, true)) != 0)
 	{
-		ConsoleSendKey(CONSOLE_MESSAGE_INFO, nch->key);
-		va_list args;
+		if (c != '%')
+		continue;
+		while ((c = CONSOLE_READ_BYTE(format, true)) != 0 && strchr("-.0123456789lzh", c) != NULL)
+		format++;
+		if (c == 0)
+		break;
+		format++;
+		if (c == 's')
+		args[i].s = "?";
+		if (strchr("spdixXucf", c) != NULL)
+		i++;
+	}
+}
 
-		va_start(args, format);
-		print(0, format, args);
-		UsartWriteByte(con_man.port, CONFIG_CONSOLE_LINE_ENDING_CHAR);
-		xSemaphoreGive(con_man.lock);
+static void ConsoleCrashPrint(const ConsoleCrashEntry *entry)
+{
+	if (entry->crc != ConsoleCrashEntryCrc(entry))
+	return;
+	if (entry->type > CONSOLE_MESSAGE_REPLY || (entry->argc > CONFIG_CONSOLE_MAX_ARGS && entry->argc != CONSOLE_RECORD_LITERAL))
+	return;
+	ConsoleNode *node = con_man.con_node;
+	for (uint8_t i = 0; i < con_man.channel_count; i++)
+	{
+		if (con_man.channels[i]->index == entry->channel)
+		node = con_man.channels[i];
+	}
+	ConsoleArg args[CONFIG_CONSOLE_MAX_ARGS];
+	if (entry->argc != CONSOLE_RECORD_LITERAL)
+	{
+		memcpy(args, entry->args, entry->argc * sizeof(ConsoleArg));
+		ConsoleCrashStrings(entry->format, args, entry->argc);
 	}
+	ConsoleArgs in = CONSOLE_ARGS(args, entry->argc);
+	ConsoleRender(node, entry->type, entry->format, (entry->argc != CONSOLE_RECORD_LITERAL) ? &in : NULL, CONSOLE_POLICY_BLOCK, CONSOLE_RECORD_TICK(*entry));
 }
 
-void ConsoleWarnf(ConsoleChannel ch, const char *format, ...)
+#endif
+
+/* Print the log from before the reset, oldest first, then start a new one. */
+static void ConsoleCrashReplay(void)
 {
-	if (ch == NULL)
+	if (con_man.crash_armed)
 	return;
-	ConsoleNode *nch = (ConsoleNode *)ch;
-	if (con_man.enable_warning != true || nch->enable_warning != true)
+	uint8_t count = console_crash.count;
+#if CONFIG_CONSOLE_TOKENIZED
+	uint8_t data[CONFIG_CONSOLE_TOKEN_RECORD_LENGTH];
+	uint8_t len = ConsoleTokenize(data, con_man.con_node, CONSOLE_MESSAGE_WARN, CONSOLE_TOKEN("%u messages from before the reset:"), CONSOLE_ARG_UINT, (unsigned int)count);
+	ConsoleRenderBytes(data, len, CONSOLE_POLICY_BLOCK, 0);
+#else
+	ConsoleArg arg;
+	arg.u = count;
+	ConsoleArgs in = CONSOLE_ARGS(&arg, 1);
+	ConsoleRender(con_man.con_node, CONSOLE_MESSAGE_WARN, CONSOLE_STR("%u messages from before the reset:"), &in, CONSOLE_POLICY_BLOCK, 0);
+#endif
+	uint8_t i = (console_crash.head + CONFIG_CONSOLE_CRASH_LOG_LENGTH - count) % CONFIG_CONSOLE_CRASH_LOG_LENGTH;
+	while (count-- > 0)
+	{
+		ConsoleCrashPrint(&console_crash.entries[i]);
+		if (++i >= CONFIG_CONSOLE_CRASH_LOG_LENGTH)
+		i = 0;
+	}
+	taskENTER_CRITICAL();
+	ConsoleCrashReset();
+	con_man.crash_armed = true;
+	taskEXIT_CRITICAL();
+}
+
+#endif
+
+#if CONFIG_CONSOLE_FRAMED
+
+/* Write the pending run of non-zero bytes behind its COBS code byte. */
+static void ConsoleCobsFlush(void)
+{
+	ConsoleFrame *frame = &con_man.frame;
+	uint8_t code = frame->fill + 1;
+	frame->sink->write(frame->sink, &code, 1);
+	frame->sink->write(frame->sink, frame->block, frame->fill);
+	frame->fill = 0;
+}
+
+/* A zero ends the current run, so the bytes go out as the frame is built
+ * and only one run is ever buffered. */
+static void ConsoleCobsPut(uint8_t c)
+{
+	ConsoleFrame *frame = &con_man.frame;
+	if (c == 0)
+	{
+		ConsoleCobsFlush();
+		return;
+	}
+	frame->block[frame->fill++] = c;
+	if (frame->fill == 254)
+	ConsoleCobsFlush();
+}
+
+/* Body bytes beyond CONFIG_CONSOLE_FRAME_LENGTH are cut off. */
+static void ConsoleFramePut(uint8_t c)
+{
+	ConsoleFrame *frame = &con_man.frame;
+	if (frame->len >= CONFIG_CONSOLE_FRAME_LENGTH - 2)
 	return;
-	if (xSemaphoreTake(con_man.lock, 10000) != pdFALSE)
+	frame->len++;
+	frame->crc = ConsoleCrc16(frame->crc, c);
+	ConsoleCobsPut(c);
+}
+
+/* The caller holds the console lock until ConsoleFrameEnd. */
+static void ConsoleFrameBegin(uint8_t kind, uint8_t channel, TickType_t tick)
+{
+	ConsoleFrame *frame = &con_man.frame;
+	uint32_t stamp = tick;
+	frame->fill = 0;
+	frame->len = 0;
+	frame->crc = 0xFFFF;
+	ConsoleFramePut(kind);
+	ConsoleFramePut(channel);
+	ConsoleFramePut((uint8_t)frame->sink->seq);
+	ConsoleFramePut((uint8_t)(frame->sink->seq >> 8));
+	for (uint8_t i = 0; i < 4; i++, stamp >>= 8)
+	ConsoleFramePut((uint8_t)stamp);
+	frame->sink->seq++;
+}
+
+static void ConsoleFrameEnd(void)
+{
+	uint8_t end = 0;
+	uint16_t crc = con_man.frame.crc;
+	ConsoleCobsPut((uint8_t)crc);
+	ConsoleCobsPut((uint8_t)(crc >> 8));
+	ConsoleCobsFlush();
+	con_man.frame.sink->write(con_man.frame.sink, &end, 1);
+}
+
+/* One frame to every selected sink, in the order of ConsolePut. */
+static void ConsoleFrameSend(uint8_t kind, uint8_t channel, TickType_t tick, const uint8_t *body, uint16_t len)
+{
+	uint8_t mask = con_man.sink_select & (uint8_t)~con_man.sink_wait;
+	for (uint8_t pass = 0; pass < 2; pass++, mask = con_man.sink_wait)
 	{
-		ConsoleSendKey(CONSOLE_MESSAGE_WARN, nch->key);
-		va_list args;
+		for (uint8_t i = 0; i < con_man.sink_count; i++)
+		{
+			if ((mask & (1 << i)) == 0)
+			continue;
+			con_man.frame.sink = con_man.sinks[i];
+			ConsoleFrameBegin(kind, channel, tick);
+			for (uint16_t k = 0; k < len; k++)
+			ConsoleFramePut(body[k]);
+			ConsoleFrameEnd();
+		}
+	}
+}
 
-		va_start(args, format);
-		print(0, format, args);
-		UsartWriteByte(con_man.port, CONFIG_CONSOLE_LINE_ENDING_CHAR);
-		xSemaphoreGive(con_man.lock);
+/* Encoded size of a frame with len body bytes, delimiter included. */
+static uint16_t ConsoleFrameSize(uint16_t len)
+{
+	uint16_t raw = CONSOLE_FRAME_HEADER + len;
+	if (raw > CONFIG_CONSOLE_FRAME_LENGTH - 2)
+	raw = CONFIG_CONSOLE_FRAME_LENGTH - 2;
+	raw += 2;
+	return raw + raw / 254 + 2;
+}
+
+static void ConsoleSendBytes(ConsoleNode *node, uint8_t kind, const char *text)
+{
+	if (ConsoleLock(CONFIG_CONSOLE_BLOCK_TIMEOUT) == false)
+	return;
+	ConsoleSinkSelect(CONSOLE_LEVEL_NONE, 0, true);
+	ConsoleFrameSend(kind, node->index, xTaskGetTickCount(), (const uint8_t *)text, strlen(text));
+	xSemaphoreGive(con_man.lock);
+}
+
+#endif
+
+#if CONFIG_CONSOLE_TOKENIZED == 0
+
+#if CONSOLE_USE_WIRE == 0
+static const char * const console_labels[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "REPLY" };
+
+/* ">KEY[LEVEL]: " in front of every text line. */
+static void ConsoleFormatKey(ConsoleOut *out, ConsoleMessageType type, const char *key)
+{
+	printchar(out, '>');
+	prints(out, key, 0, 0);
+	printchar(out, '[');
+	prints(out, console_labels[type], 0, 0);
+	prints(out, "]: ", 0, 0);
+}
+#endif
+
+/* The line is formatted on the caller's stack, the lock is only held to hand
+ * it to the port. Returns false when the message was dropped. Anything but
+ * the blocking policy writes only when the whole line fits in the port right
+ * now, so the caller never waits on the lock or the UART. */
+static bool ConsoleRender(ConsoleNode *node, ConsoleMessageType type, const char *format, ConsoleArgs *in, uint8_t policy, TickType_t tick)
+{
+	char line[CONFIG_CONSOLE_LINE_LENGTH];
+	ConsoleOut out = { line, sizeof(line), 0 };
+#if CONFIG_CONSOLE_FRAMED == 0
+	ConsoleFormatKey(&out, type, node->key);
+#endif
+	if (in == NULL)
+	{
+		char c;
+		while ((c = CONSOLE_READ_BYTE(format++, true)) != 0)
+		printchar(&out, c);
 	}
+	else
+	print(&out, format, true, in);
+
+	CONSOLE_PEAK(con_man.stats.line_peak, out.pos);
+#if CONFIG_CONSOLE_FRAMED == 0
+	/* printchar keeps the last byte free, it takes the line ending. */
+	line[out.pos++] = CONFIG_CONSOLE_LINE_ENDING_CHAR;
+#endif
+	return ConsoleSendLine(node, CONSOLE_WIRE_TEXT | type, (const uint8_t *)line, out.pos, policy, tick);
 }
 
-void ConsoleErrorf(ConsoleChannel ch, const char *format, ...)
+/* Hand a formatted line to the sinks, framed as a message of the given kind.
+ * Returns false when it was dropped. */
+static bool ConsoleSendLine(ConsoleNode *node, uint8_t kind, const uint8_t *line, uint16_t len, uint8_t policy, TickType_t tick)
 {
-	if (ch == NULL)
+	ConsoleMessageType type = kind & 0x0F;
+	bool block = (policy == CONSOLE_POLICY_BLOCK);
+#if CONSOLE_USE_LANES
+	bool sent = true;
+	if (type == CONSOLE_MESSAGE_ERROR && con_man.lanes)
+	{
+		sent = ConsoleUrgentWrite(line, len, block);
+		if (con_man.sink_count == 1)
+		return sent;
+	}
+#endif
+	if (ConsoleLock(block ? CONFIG_CONSOLE_BLOCK_TIMEOUT : 0) == false)
+	return false;
+#if CONFIG_CONSOLE_FRAMED
+	bool fits = ConsoleSinkSelect(type, ConsoleFrameSize(len), block);
+	ConsoleFrameSend(kind, node->index, tick, line, len);
+#else
+	(void)node;
+	(void)tick;
+	bool fits = ConsoleSinkSelect(type, ConsoleWireSize(len), block);
+	ConsolePut(line, len);
+	ConsoleFlush();
+#endif
+	xSemaphoreGive(con_man.lock);
+#if CONSOLE_USE_LANES
+	return fits && sent;
+#else
+	return fits;
+#endif
+}
+
+#if CONFIG_CONSOLE_DEFERRED == 0
+/* Direct output of a log call, counts the drop or follows a delivered line
+ * with the summary of earlier drops. */
+static void ConsoleEmit(ConsoleNode *node, ConsoleMessageType type, const char *format, va_list *ap)
+{
+#if CONFIG_CONSOLE_CRASH_LOG
+	/* The crash log keeps a packed copy, the line is formatted from ap. */
+	ConsoleArg argv[CONFIG_CONSOLE_MAX_ARGS];
+	uint8_t argc = CONSOLE_RECORD_LITERAL;
+	if (ap != NULL)
+	{
+		va_list copy;
+		va_copy(copy, *ap);
+		argc = ConsolePackArgs(argv, format, true, &copy);
+		va_end(copy);
+	}
+	ConsoleCrashSave(node, type, format, argv, argc, CONSOLE_NOW(), false);
+#endif
+	ConsoleArgs in = { ap, NULL, NULL };
+	if (ConsoleRender(node, type, format, (ap != NULL) ? &in : NULL, node->policy, CONSOLE_NOW()) == false)
+	ConsoleCountDrops(node, 1, false);
+	else
+	ConsoleReportDrops(node, node->policy);
+}
+#endif
+
+#endif
+
+#if CONSOLE_USE_RECORDS
+
+/* Claim the slot at rec_head. Only the index bump is serialised, the record
+ * itself is filled in afterwards and published through its ready flag.
+ * Returns -1 when the queue is full. */
+static int16_t ConsoleRecordReserve(bool from_isr, bool *was_empty)
+{
+	uint8_t head;
+	uint8_t next;
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_1)
+	(void)from_isr;
+	head = CONSOLE_LOAD(con_man.rec_head);
+	do
+	{
+		next = head + 1;
+		if (next == CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH)
+		next = 0;
+		if (next == CONSOLE_LOAD(con_man.rec_tail))
+		return -1;
+	} while (__atomic_compare_exchange_n(&con_man.rec_head, &head, next, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) == false);
+	*was_empty = (head == CONSOLE_LOAD(con_man.rec_tail));
+#else
+	bool full;
+	UBaseType_t mask = 0;
+	if (from_isr)
+	mask = taskENTER_CRITICAL_FROM_ISR();
+	else
+	taskENTER_CRITICAL();
+	head = con_man.rec_head;
+	next = head + 1;
+	if (next == CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH)
+	next = 0;
+	full = (next == con_man.rec_tail);
+	if (full == false)
+	{
+		*was_empty = (head == con_man.rec_tail);
+		con_man.rec_head = next;
+	}
+	if (from_isr)
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	else
+	taskEXIT_CRITICAL();
+	if (full)
+	return -1;
+#endif
+	return head;
+}
+
+/* Clear a ready flag that is set. Whoever clears it owns the record. */
+static bool ConsoleClaim(volatile uint8_t *ready, bool from_isr)
+{
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_1)
+	(void)from_isr;
+	uint8_t expected = true;
+	return __atomic_compare_exchange_n(ready, &expected, false, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+#else
+	UBaseType_t mask = 0;
+	if (from_isr)
+	mask = taskENTER_CRITICAL_FROM_ISR();
+	else
+	taskENTER_CRITICAL();
+	bool claimed = (*ready != false);
+	*ready = false;
+	if (from_isr)
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	else
+	taskEXIT_CRITICAL();
+	return claimed;
+#endif
+}
+
+/* Take the oldest published record. Both the log task and a producer that
+ * evicts the oldest record come through here, the ready flag decides who gets
+ * it. Returns -1 when the queue is empty or the tail is still being filled in. */
+static int16_t ConsoleRecordTake(bool from_isr)
+{
+	uint8_t tail = CONSOLE_LOAD(con_man.rec_tail);
+	if (tail == CONSOLE_LOAD(con_man.rec_head))
+	return -1;
+	if (ConsoleClaim(&con_man.records[tail].ready, from_isr) == false)
+	return -1;
+	if (CONSOLE_LOAD(con_man.rec_tail) != tail)
+	{
+		/* Claimed a newer record that was reused in the slot, give it back. */
+		CONSOLE_STORE(con_man.records[tail].ready, true);
+		return -1;
+	}
+	return tail;
+}
+
+/* Only the owner of the tail record moves the tail. */
+static void ConsoleRecordRelease(uint8_t slot)
+{
+	if (++slot == CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH)
+	slot = 0;
+	CONSOLE_STORE(con_man.rec_tail, slot);
+}
+
+/* Claim a slot for node, handling a full queue as the channel policy says.
+ * ISRs never wait. Returns -1 when the message is dropped. */
+static int16_t ConsoleRecordSlot(ConsoleNode *node, bool from_isr, bool *was_empty)
+{
+	TickType_t waited = 0;
+	int16_t slot;
+	while ((slot = ConsoleRecordReserve(from_isr, was_empty)) < 0)
+	{
+		if (node->policy == CONSOLE_POLICY_DROP_OLDEST)
+		{
+			int16_t oldest = ConsoleRecordTake(from_isr);
+			if (oldest >= 0)
+			{
+				ConsoleNode *owner = con_man.records[oldest].node;
+				ConsoleRecordRelease(oldest);
+				ConsoleCountDrops(owner, 1, from_isr);
+				continue;
+			}
+		}
+		if (from_isr || node->policy != CONSOLE_POLICY_BLOCK || waited++ >= CONFIG_CONSOLE_BLOCK_TIMEOUT)
+		{
+			ConsoleCountDrops(node, 1, from_isr);
+			return -1;
+		}
+		vTaskDelay(1);
+	}
+#if CONFIG_CONSOLE_FRAMED
+	con_man.records[slot].tick = from_isr ? xTaskGetTickCountFromISR() : xTaskGetTickCount();
+#endif
+	return slot;
+}
+
+/* Hand a filled record to ConsoleLogTask. Returns true when a higher
+ * priority task was woken from an ISR. */
+static bool ConsoleRecordPublish(ConsoleRecord *rec, bool was_empty, bool from_isr)
+{
+	CONSOLE_STORE(rec->ready, true);
+
+	if (was_empty == false)
+	return false;
+	if (from_isr)
+	{
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveFromISR(con_man.log_task, &woken);
+		return woken != pdFALSE;
+	}
+	xTaskNotifyGive(con_man.log_task);
+	return false;
+}
+
+#if CONFIG_CONSOLE_TOKENIZED == 0
+/* Copy the arguments by the types the log macro took from their C types,
+ * no format is read. Each is widened like ConsoleVaArg does. */
+static uint8_t ConsoleTypedArgs(ConsoleArg *args, uint32_t types, va_list *ap)
+{
+	uint8_t count = 0;
+	for (; types != 0 && count < CONFIG_CONSOLE_MAX_ARGS; types >>= 4)
+	{
+		ConsoleArg *arg = &args[count++];
+		switch (types & 0x0F)
+		{
+			case CONSOLE_ARG_INT:
+			arg->u = (ConsoleUint)(ConsoleInt)va_arg(*ap, int);
+			break;
+			case CONSOLE_ARG_UINT:
+			arg->u = va_arg(*ap, unsigned int);
+			break;
+			case CONSOLE_ARG_LONG:
+			arg->u = (ConsoleUint)(ConsoleInt)va_arg(*ap, long);
+			break;
+			case CONSOLE_ARG_ULONG:
+			arg->u = va_arg(*ap, unsigned long);
+			break;
+			case CONSOLE_ARG_LLONG:
+			arg->u = (ConsoleUint)(ConsoleInt)va_arg(*ap, long long);
+			break;
+			case CONSOLE_ARG_ULLONG:
+			arg->u = (ConsoleUint)va_arg(*ap, unsigned long long);
+			break;
+			case CONSOLE_ARG_DOUBLE:
+			arg->f = va_arg(*ap, double);
+			break;
+			case CONSOLE_ARG_STRING:
+			arg->s = va_arg(*ap, const char *);
+			break;
+			default:
+			arg->u = (uintptr_t)va_arg(*ap, void *);
+			break;
+		}
+	}
+	return count;
+}
+
+/* Queue a record for ConsoleLogTask. ap == NULL queues format as a plain
+ * string. types come from the log macro, or CONSOLE_TYPES_FORMAT for a direct
+ * ConsoleLogf call. */
+static bool ConsoleRecordSubmit(ConsoleNode *node, ConsoleMessageType type, const char *format, uint32_t types, va_list *ap, bool from_isr)
+{
+	bool was_empty = false;
+	int16_t slot = ConsoleRecordSlot(node, from_isr, &was_empty);
+	if (slot < 0)
+	return false;
+
+	ConsoleRecord *rec = &con_man.records[slot];
+	rec->format = format;
+	rec->node = node;
+	rec->type = type;
+	if (ap == NULL)
+	rec->argc = CONSOLE_RECORD_LITERAL;
+	else if (types == CONSOLE_TYPES_FORMAT)
+	rec->argc = ConsolePackArgs(rec->args, format, true, ap);
+	else
+	rec->argc = ConsoleTypedArgs(rec->args, types, ap);
+	ConsoleCrashSave(node, type, format, rec->args, rec->argc, CONSOLE_RECORD_TICK(*rec), from_isr);
+	return ConsoleRecordPublish(rec, was_empty, from_isr);
+}
+#endif
+
+void ConsoleLogTask(void *param)
+{
+	TickType_t wait = portMAX_DELAY;
+#if CONFIG_CONSOLE_CRASH_LOG
+	ConsoleCrashReplay();
+#endif
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, wait);
+		wait = portMAX_DELAY;
+		while (CONSOLE_LOAD(con_man.rec_tail) != CONSOLE_LOAD(con_man.rec_head))
+		{
+#if CONFIG_CONSOLE_STATS
+			uint8_t depth = (CONSOLE_LOAD(con_man.rec_head) + CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH - CONSOLE_LOAD(con_man.rec_tail)) % CONFIG_CONSOLE_DEFERRED_QUEUE_LENGTH;
+			CONSOLE_PEAK(con_man.stats.queue_peak, depth);
+#endif
+			int16_t slot = ConsoleRecordTake(false);
+			if (slot < 0)
+			{
+				/* Claimed but still being filled in, look again next tick. */
+				wait = 1;
+				break;
+			}
+			/* Free the slot before the slow part so producers are not held up. */
+			ConsoleRecord rec = con_man.records[slot];
+			ConsoleRecordRelease(slot);
+#if CONFIG_CONSOLE_TOKENIZED
+			if (ConsoleRenderBytes(rec.data, rec.len, CONSOLE_POLICY_BLOCK, CONSOLE_RECORD_TICK(rec)) == false)
+#else
+			ConsoleArgs in = CONSOLE_ARGS(rec.args, rec.argc);
+			if (ConsoleRender(rec.node, rec.type, rec.format, (rec.argc != CONSOLE_RECORD_LITERAL) ? &in : NULL, CONSOLE_POLICY_BLOCK, CONSOLE_RECORD_TICK(rec)) == false)
+#endif
+			ConsoleCountDrops(rec.node, 1, false);
+		}
+		/* Caught up, report what was lost on the way. */
+		if (wait == portMAX_DELAY)
+		{
+			for (uint8_t i = 0; i < con_man.channel_count; i++)
+			ConsoleReportDrops(con_man.channels[i], CONSOLE_POLICY_BLOCK);
+		}
+	}
+}
+
+#endif
+
+#if CONFIG_CONSOLE_TOKENIZED
+
+extern const char __start_console_tokens[];
+
+static uint8_t ConsolePutVarint(uint8_t *data, uint8_t pos, uint64_t value)
+{
+	while (value >= 0x80 && pos < CONFIG_CONSOLE_TOKEN_RECORD_LENGTH)
+	{
+		data[pos++] = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+	if (pos < CONFIG_CONSOLE_TOKEN_RECORD_LENGTH)
+	data[pos] = (uint8_t)value;
+	return pos + 1;
+}
+
+static uint8_t ConsolePutSigned(uint8_t *data, uint8_t pos, int64_t value)
+{
+	return ConsolePutVarint(data, pos, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+/* Record header, the length byte is filled in by ConsoleWireEnd. */
+static uint8_t ConsoleWireBegin(uint8_t *data, uint8_t kind, const ConsoleNode *node)
+{
+	data[0] = CONSOLE_WIRE_START;
+	data[1] = 0;
+	data[2] = kind;
+	data[3] = node->index;
+	return CONSOLE_WIRE_HEADER;
+}
+
+static uint8_t ConsoleWireEnd(uint8_t *data, uint8_t len)
+{
+	data[1] = len - 2;
+	return len;
+}
+
+/* Encode a tokenized message into data. An argument that does not fit is
+ * left out together with everything after it. */
+static uint8_t ConsoleTokenEncode(uint8_t *data, ConsoleNode *node, uint8_t level, const char *token, uint32_t types, va_list ap)
+{
+	uint8_t pos = ConsoleWireBegin(data, CONSOLE_WIRE_TOKEN | level, node);
+	pos = ConsolePutVarint(data, pos, (uint16_t)(token - __start_console_tokens));
+	for (; types != 0; types >>= 4)
+	{
+		uint8_t start = pos;
+		switch (types & 0x0F)
+		{
+			case CONSOLE_ARG_INT:
+			pos = ConsolePutSigned(data, pos, va_arg(ap, int));
+			break;
+			case CONSOLE_ARG_UINT:
+			pos = ConsolePutSigned(data, pos, va_arg(ap, unsigned int));
+			break;
+			case CONSOLE_ARG_LONG:
+			pos = ConsolePutSigned(data, pos, va_arg(ap, long));
+			break;
+			case CONSOLE_ARG_ULONG:
+			pos = ConsolePutSigned(data, pos, va_arg(ap, unsigned long));
+			break;
+			case CONSOLE_ARG_LLONG:
+			pos = ConsolePutSigned(data, pos, va_arg(ap, long long));
+			break;
+			case CONSOLE_ARG_ULLONG:
+			pos = ConsolePutSigned(data, pos, (int64_t)va_arg(ap, unsigned long long));
+			break;
+			case CONSOLE_ARG_POINTER:
+			pos = ConsolePutSigned(data, pos, (uintptr_t)va_arg(ap, void *));
+			break;
+			case CONSOLE_ARG_DOUBLE:
+			{
+				float f = (float)va_arg(ap, double);
+				uint32_t bits;
+				memcpy(&bits, &f, sizeof(bits));
+				if (pos + 4 > CONFIG_CONSOLE_TOKEN_RECORD_LENGTH)
+				{
+					pos = CONFIG_CONSOLE_TOKEN_RECORD_LENGTH + 1;
+					break;
+				}
+				for (uint8_t i = 0; i < 4; i++, bits >>= 8)
+				data[pos++] = (uint8_t)bits;
+				break;
+			}
+			case CONSOLE_ARG_STRING:
+			{
+				const char *str = va_arg(ap, const char *);
+				if (pos + 1 > CONFIG_CONSOLE_TOKEN_RECORD_LENGTH)
+				{
+					pos = CONFIG_CONSOLE_TOKEN_RECORD_LENGTH + 1;
+					break;
+				}
+				uint8_t len = (str != NULL) ? strnlen(str, CONFIG_CONSOLE_TOKEN_RECORD_LENGTH - pos - 1) : 0;
+				data[pos++] = len;
+				memcpy(&data[pos], str, len);
+				pos += len;
+				break;
+			}
+			default:
+			break;
+		}
+		if (pos > CONFIG_CONSOLE_TOKEN_RECORD_LENGTH)
+		{
+			pos = start;
+			break;
+		}
+	}
+	CONSOLE_PEAK(con_man.stats.line_peak, pos);
+	return ConsoleWireEnd(data, pos);
+}
+
+static uint8_t ConsoleTokenize(uint8_t *data, ConsoleNode *node, uint8_t level, const char *token, uint32_t types, ...)
+{
+	va_list args;
+	va_start(args, types);
+	uint8_t len = ConsoleTokenEncode(data, node, level, token, types, args);
+	va_end(args);
+	return len;
+}
+
+/* Same rules as the text output: anything but the blocking policy writes only
+ * when the whole record fits right now. */
+static bool ConsoleRenderBytes(const uint8_t *data, uint8_t len, uint8_t policy, TickType_t tick)
+{
+	bool block = (policy == CONSOLE_POLICY_BLOCK);
+	/* Channel records have no level. */
+	uint8_t level = ((data[2] & 0xF0) == CONSOLE_WIRE_CHANNEL) ? CONSOLE_LEVEL_NONE : (data[2] & 0x0F);
+#if CONSOLE_USE_LANES
+	bool sent = true;
+	if (level == CONSOLE_LEVEL_ERROR && con_man.lanes)
+	{
+		sent = ConsoleUrgentWrite(data, len, block);
+		if (con_man.sink_count == 1)
+		return sent;
+	}
+#endif
+	if (ConsoleLock(block ? CONFIG_CONSOLE_BLOCK_TIMEOUT : 0) == false)
+	return false;
+#if CONFIG_CONSOLE_FRAMED
+	/* Same record, sent as a frame without the start and length bytes. */
+	bool fits = ConsoleSinkSelect(level, ConsoleFrameSize(len - CONSOLE_WIRE_HEADER), block);
+	ConsoleFrameSend(data[2], data[3], tick, &data[CONSOLE_WIRE_HEADER], len - CONSOLE_WIRE_HEADER);
+#else
+	(void)tick;
+	bool fits = ConsoleSinkSelect(level, ConsoleWireSize(len), block);
+	ConsolePut(data, len);
+	ConsoleFlush();
+#endif
+	xSemaphoreGive(con_man.lock);
+#if CONSOLE_USE_LANES
+	return fits && sent;
+#else
+	return fits;
+#endif
+}
+
+#if CONFIG_CONSOLE_FRAMED == 0
+static void ConsoleSendBytes(ConsoleNode *node, uint8_t kind, const char *text)
+{
+	uint8_t data[CONSOLE_WIRE_HEADER + CONFIG_CONSOLE_REPLY_BUFFER_LENGTH];
+	uint8_t pos = ConsoleWireBegin(data, kind, node);
+	uint8_t len = strnlen(text, CONFIG_CONSOLE_REPLY_BUFFER_LENGTH);
+	memcpy(&data[pos], text, len);
+	ConsoleRenderBytes(data, ConsoleWireEnd(data, pos + len), CONSOLE_POLICY_BLOCK, 0);
+}
+#endif
+
+void ConsoleLogToken(ConsoleChannel ch, uint8_t level, const char *token, uint32_t types, ...)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
+	return;
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+	va_list args;
+
+	va_start(args, types);
+#if CONFIG_CONSOLE_DEFERRED
+	bool was_empty = false;
+	int16_t slot = ConsoleRecordSlot(nch, false, &was_empty);
+	if (slot >= 0)
+	{
+		ConsoleRecord *rec = &con_man.records[slot];
+		rec->node = nch;
+		rec->len = ConsoleTokenEncode(rec->data, nch, level, token, types, args);
+		ConsoleCrashSave(rec->data, rec->len, CONSOLE_RECORD_TICK(*rec), false);
+		ConsoleRecordPublish(rec, was_empty, false);
+	}
+#else
+	uint8_t data[CONFIG_CONSOLE_TOKEN_RECORD_LENGTH];
+	uint8_t len = ConsoleTokenEncode(data, nch, level, token, types, args);
+	ConsoleCrashSave(data, len, CONSOLE_NOW(), false);
+	if (ConsoleRenderBytes(data, len, nch->policy, CONSOLE_NOW()) == false)
+	ConsoleCountDrops(nch, 1, false);
+	else
+	ConsoleReportDrops(nch, nch->policy);
+#endif
+	va_end(args);
+}
+
+#if CONFIG_CONSOLE_ISR_LOG
+
+bool ConsoleLogTokenFromISR(ConsoleChannel ch, uint8_t level, const char *token, uint32_t types, ...)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
+	return false;
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+	bool was_empty = false;
+	int16_t slot = ConsoleRecordSlot(nch, true, &was_empty);
+	if (slot < 0)
+	return false;
+
+	va_list args;
+	va_start(args, types);
+	ConsoleRecord *rec = &con_man.records[slot];
+	rec->node = nch;
+	rec->len = ConsoleTokenEncode(rec->data, nch, level, token, types, args);
+	va_end(args);
+	ConsoleCrashSave(rec->data, rec->len, CONSOLE_RECORD_TICK(*rec), true);
+	return ConsoleRecordPublish(rec, was_empty, true);
+}
+
+#endif
+
+#else
+
+void ConsoleLogf(ConsoleChannel ch, uint8_t level, const char *format, ...)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
 	return;
 	ConsoleNode *nch = (ConsoleNode *)ch;
-	if (con_man.enable_error_log != true || nch->enable_error_log != true)
+	CONSOLE_STAT(nch->logged++);
+	va_list args;
+
+	va_start(args, format);
+#if CONFIG_CONSOLE_DEFERRED
+	ConsoleRecordSubmit(nch, level, format, CONSOLE_TYPES_FORMAT, &args, false);
+#else
+	ConsoleEmit(nch, level, format, &args);
+#endif
+	va_end(args);
+}
+
+#if CONFIG_CONSOLE_DEFERRED
+void ConsoleLogTyped(ConsoleChannel ch, uint8_t level, const char *format, uint32_t types, ...)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
 	return;
-	if (xSemaphoreTake(con_man.lock, 10000) != pdFALSE)
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+	va_list args;
+
+	va_start(args, types);
+	ConsoleRecordSubmit(nch, level, format, types, &args, false);
+	va_end(args);
+}
+#endif
+
+#if CONFIG_CONSOLE_ISR_LOG
+
+bool ConsoleLogFromISR(ConsoleChannel ch, uint8_t level, const char *str)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
+	return false;
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+	return ConsoleRecordSubmit(nch, level, str, 0, NULL, true);
+}
+
+bool ConsoleLogfFromISR(ConsoleChannel ch, uint8_t level, const char *format, ...)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
+	return false;
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+	va_list args;
+	va_start(args, format);
+	bool woken = ConsoleRecordSubmit(nch, level, format, CONSOLE_TYPES_FORMAT, &args, true);
+	va_end(args);
+	return woken;
+}
+
+bool ConsoleLogTypedFromISR(ConsoleChannel ch, uint8_t level, const char *format, uint32_t types, ...)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
+	return false;
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+	va_list args;
+	va_start(args, types);
+	bool woken = ConsoleRecordSubmit(nch, level, format, types, &args, true);
+	va_end(args);
+	return woken;
+}
+
+#endif
+
+#endif
+
+#if CONSOLE_USE_WIRE
+
+/* Replies stay text, a handler builds them at run time. */
+static void ConsoleSendText(ConsoleNode *node, ConsoleMessageType type, const char *text)
+{
+	ConsoleSendBytes(node, CONSOLE_WIRE_TEXT | type, text);
+}
+
+/* Tell the host which key belongs to a channel index. */
+static void ConsoleAnnounce(ConsoleNode *node)
+{
+	ConsoleSendBytes(node, CONSOLE_WIRE_CHANNEL, node->key);
+}
+
+#endif
+
+/* Dumps go out in chunks, one text line or one dump record each. */
+#if CONSOLE_USE_WIRE
+#define CONSOLE_DUMP_CHUNK		16
+#else
+#define CONSOLE_DUMP_CHUNK		CONFIG_CONSOLE_DUMP_WIDTH
+/* Longest ">KEY[LEVEL]: ", the offset, three columns per byte in hex and one in ASCII, the line ending. */
+#define CONSOLE_DUMP_LINE		(19 + 6 + 4 * CONFIG_CONSOLE_DUMP_WIDTH + 2)
+#if CONSOLE_DUMP_LINE > CONFIG_CONSOLE_LINE_LENGTH
+#error "CONFIG_CONSOLE_DUMP_WIDTH needs a longer CONFIG_CONSOLE_LINE_LENGTH"
+#endif
+#endif
+
+#if CONFIG_CONSOLE_TOKENIZED
+static bool ConsoleDumpChunk(ConsoleNode *node, uint8_t level, uint16_t offset, const uint8_t *data, uint8_t len)
+{
+	uint8_t record[CONSOLE_WIRE_HEADER + 2 + CONSOLE_DUMP_CHUNK];
+	uint8_t pos = ConsoleWireBegin(record, CONSOLE_WIRE_DUMP | level, node);
+	record[pos++] = (uint8_t)offset;
+	record[pos++] = (uint8_t)(offset >> 8);
+	memcpy(&record[pos], data, len);
+	return ConsoleRenderBytes(record, ConsoleWireEnd(record, pos + len), node->policy, CONSOLE_NOW());
+}
+#elif CONFIG_CONSOLE_FRAMED
+static bool ConsoleDumpChunk(ConsoleNode *node, uint8_t level, uint16_t offset, const uint8_t *data, uint8_t len)
+{
+	uint8_t body[2 + CONSOLE_DUMP_CHUNK];
+	body[0] = (uint8_t)offset;
+	body[1] = (uint8_t)(offset >> 8);
+	memcpy(&body[2], data, len);
+	return ConsoleSendLine(node, CONSOLE_WIRE_DUMP | level, body, 2 + len, node->policy, CONSOLE_NOW());
+}
+#else
+/* "0010  de ad be ef 00 00 00 00  ....\n", a short last line is padded so
+ * the ASCII column stays in place. */
+static bool ConsoleDumpChunk(ConsoleNode *node, uint8_t level, uint16_t offset, const uint8_t *data, uint8_t len)
+{
+	char line[CONSOLE_DUMP_LINE];
+	ConsoleOut out = { line, sizeof(line), 0 };
+	ConsoleFormatKey(&out, level, node->key);
+
+	char *hex = &line[out.pos];
+	for (int8_t shift = 12; shift >= 0; shift -= 4)
+	*hex++ = CONSOLE_READ_BYTE(&console_hex_digits[(offset >> shift) & 0x0F], true);
+	*hex++ = ' ';
+	*hex++ = ' ';
+	char *ascii = hex + 3 * CONFIG_CONSOLE_DUMP_WIDTH + 1;
+	for (uint8_t i = 0; i < CONFIG_CONSOLE_DUMP_WIDTH; i++, hex += 3)
 	{
-		ConsoleSendKey(CONSOLE_MESSAGE_ERROR, nch->key);
-		va_list args;
+		if (i < len)
+		{
+			uint8_t c = data[i];
+			hex[0] = CONSOLE_READ_BYTE(&console_hex_digits[c >> 4], true);
+			hex[1] = CONSOLE_READ_BYTE(&console_hex_digits[c & 0x0F], true);
+			ascii[i] = (c >= ' ' && c < 0x7F) ? (char)c : '.';
+		}
+		else
+		{
+			hex[0] = ' ';
+			hex[1] = ' ';
+		}
+		hex[2] = ' ';
+	}
+	*hex = ' ';
+	ascii[len] = CONFIG_CONSOLE_LINE_ENDING_CHAR;
+	uint16_t pos = &ascii[len + 1] - line;
+	CONSOLE_PEAK(con_man.stats.line_peak, pos);
+	return ConsoleSendLine(node, CONSOLE_WIRE_TEXT | level, (const uint8_t *)line, pos, node->policy, 0);
+}
+#endif
 
-		va_start(args, format);
-		print(0, format, args);
-		UsartWriteByte(con_man.port, CONFIG_CONSOLE_LINE_ENDING_CHAR);
-		xSemaphoreGive(con_man.lock);
+void ConsoleDump(ConsoleChannel ch, uint8_t level, const void *data, uint16_t len)
+{
+	if (ConsoleLevelEnabled(ch, level) != true)
+	return;
+	ConsoleNode *nch = (ConsoleNode *)ch;
+	CONSOLE_STAT(nch->logged++);
+	const uint8_t *bytes = data;
+	uint16_t offset = 0;
+	bool sent = true;
+	while (len > 0)
+	{
+		uint8_t chunk = (len < CONSOLE_DUMP_CHUNK) ? len : CONSOLE_DUMP_CHUNK;
+		sent = ConsoleDumpChunk(nch, level, offset, &bytes[offset], chunk);
+		if (sent == false)
+		ConsoleCountDrops(nch, 1, false);
+		offset += chunk;
+		len -= chunk;
 	}
-}
\ No newline at end of file
+	/* Earlier drops are reported after the dump, not in the middle of it. */
+	if (sent)
+	ConsoleReportDrops(nch, nch->policy);
+}
@@ -29,21 +29,330 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
 
+#include "config.h"
+
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+/* Keep literals passed to the log macros in flash instead of SRAM. */
+#define CONSOLE_STR(s)		PSTR(s)
+#define CONSOLE_FLASH_DATA	PROGMEM
+#else
+#define CONSOLE_STR(s)		(s)
+#define CONSOLE_FLASH_DATA
+#endif
+
+#define CONSOLE_LEVEL_TRACE		0
+#define CONSOLE_LEVEL_DEBUG		1
+#define CONSOLE_LEVEL_INFO		2
+#define CONSOLE_LEVEL_WARN		3
+#define CONSOLE_LEVEL_ERROR		4
+#define CONSOLE_LEVEL_NONE		5
+
+#define CONSOLE_MASK(level)		((uint8_t)(1 << (level)))
+#define CONSOLE_MASK_ALL		((uint8_t)((1 << CONSOLE_LEVEL_NONE) - 1))
+/* Replies, printf and channel announcements have no level, a sink takes them with this bit. */
+#define CONSOLE_MASK_REPLY		CONSOLE_MASK(CONSOLE_LEVEL_NONE)
+
+/* Stack a task needs on top of its own use to log a text line directly. */
+#if CONFIG_CONSOLE_DEFERRED || CONFIG_CONSOLE_TOKENIZED
+#define CONSOLE_LOG_STACK		0
+#else
+#define CONSOLE_LOG_STACK		CONFIG_CONSOLE_LINE_LENGTH
+#endif
 
 typedef void * ConsoleChannel;
 
+/* Every channel starts with this, so the level check can be done inline. */
+typedef struct
+{
+	volatile uint8_t level_mask;
+} ConsoleChannelBase;
+
+/* Levels enabled for all channels, see CONSOLE <level> ON/OFF. */
+extern volatile uint8_t console_level_mask;
+
+static inline bool ConsoleLevelEnabled(ConsoleChannel ch, uint8_t level)
+{
+	return ch != NULL && (console_level_mask & ((const ConsoleChannelBase *)ch)->level_mask & CONSOLE_MASK(level)) != 0;
+}
+
+/* What a log call does when the console is busy or the record queue is full.
+ * A dropped message is counted and reported once output flows again. */
+typedef enum
+{
+	CONSOLE_POLICY_BLOCK,		/* wait up to CONFIG_CONSOLE_BLOCK_TIMEOUT ticks */
+	CONSOLE_POLICY_TRY,			/* one attempt, drop the message if it cannot go out now */
+	CONSOLE_POLICY_DROP_NEWEST,	/* like TRY, a full queue drops the new message */
+	CONSOLE_POLICY_DROP_OLDEST	/* like TRY, a full queue drops the oldest queued message */
+} ConsolePolicy;
+
 typedef void (*ConsoleHandler)(char *reply, const char **param_list, uint16_t count);
 
+/* Extra command words for a channel, matched case insensitively against the
+ * first parameter before the channel handler is called. */
+typedef struct
+{
+	const char *name;
+	ConsoleHandler handler;
+} ConsoleCommand;
+
+/* A channel. Only the console touches the fields, the struct is public so
+ * CONSOLE_CHANNEL_DEFINE can reserve one. */
+typedef struct _dbg
+{
+	ConsoleChannelBase base;
+	char key[10];
+	uint16_t hash;
+	ConsoleHandler handler;
+	const ConsoleCommand *commands;
+	uint8_t command_count;
+	uint8_t policy;
+	volatile uint16_t dropped;
+	/* Registration order, identifies the channel on the tokenized wire. */
+	uint8_t index;
+#if CONFIG_CONSOLE_STATS
+	/* Log calls past the level filter, and drops already reported. */
+	uint16_t logged;
+	uint16_t lost;
+#endif
+} ConsoleNode;
+
+/* Entry of the console_channels section, see CONSOLE_CHANNEL_DEFINE. */
+typedef struct
+{
+	const char *key;
+	ConsoleHandler handler;
+	ConsoleNode *node;
+} ConsoleChannelDef;
+
+/* Channel registered at link time: ConsoleInit finds every definition in the
+ * console_channels section and registers it, before any ConsoleCreate and
+ * without heap. name is a ConsoleChannel constant, CONSOLE_CHANNEL_DECLARE
+ * makes it known to other files. The AVR firmware links with
+ * -Wl,-T,console/console_channels.ld. */
+#define CONSOLE_CHANNEL_DEFINE(name, key, handler) \
+	static ConsoleNode console_node_##name; \
+	static const char console_key_##name[] CONSOLE_FLASH_DATA = key; \
+	static const ConsoleChannelDef console_def_##name __attribute__((section("console_channels"), used, aligned(sizeof(void *)))) = { console_key_##name, (handler), &console_node_##name }; \
+	ConsoleChannel const name = &console_node_##name
+#define CONSOLE_CHANNEL_DECLARE(name)	extern ConsoleChannel const name
+
 void ConsoleInit();
 ConsoleChannel ConsoleCreate(const char *key, ConsoleHandler handler);
+bool ConsoleAddCommands(ConsoleChannel ch, const ConsoleCommand *commands, uint8_t count);
+void ConsoleSetPolicy(ConsoleChannel ch, ConsolePolicy policy);
+
+/* Bounded formatting with the console's print engine, see "Formatting" in
+ * README.md. format must come from CONSOLE_STR(), use ConsoleSnprintf. Returns the length the whole output
+ * would have, like snprintf. */
+int ConsoleFormat(char *buf, uint16_t len, const char *format, ...);
+#define ConsoleSnprintf(buf, len, format, ...)	ConsoleFormat((buf), (len), CONSOLE_STR(format), ##__VA_ARGS__)
+
+/* Append to the reply of the command being handled, from a ConsoleHandler.
+ * Returns false when the reply buffer is full and the text was cut. */
+bool ConsoleReplyFormat(const char *format, ...);
+#define ConsoleReplyf(format, ...)				ConsoleReplyFormat(CONSOLE_STR(format), ##__VA_ARGS__)
+/* Send the reply built so far as its own line and start an empty one, for
+ * handlers with more to say than CONFIG_CONSOLE_REPLY_BUFFER_LENGTH. */
+void ConsoleReplyFlush(void);
+
+/* Output backend. A message goes to every sink whose level_mask has its level.
+ * write gets the encoded bytes of a message, in one or more pieces, with the
+ * console lock held. space returns the free room, a sink with less than a
+ * message needs skips it unless the policy blocks. NULL: always room. */
+typedef struct ConsoleSink ConsoleSink;
+
+struct ConsoleSink
+{
+	void (*write)(ConsoleSink *sink, const uint8_t *data, uint16_t len);
+	uint16_t (*space)(ConsoleSink *sink);
+	volatile uint8_t level_mask;
+#if CONFIG_CONSOLE_FRAMED
+	uint16_t seq;
+#endif
+};
+
+/* The UART sink, added by ConsoleInit with CONSOLE_MASK_ALL | CONSOLE_MASK_REPLY. */
+ConsoleSink *ConsoleUartSink(void);
+/* At most CONFIG_CONSOLE_MAX_SINKS including the UART, after ConsoleInit. */
+bool ConsoleAddSink(ConsoleSink *sink, uint8_t level_mask);
+void ConsoleSetSinkLevels(ConsoleSink *sink, uint8_t level_mask);
+
+/* Keeps the newest size bytes of its messages in buf, never blocks. */
+typedef struct
+{
+	ConsoleSink base;
+	uint8_t *buf;
+	uint16_t size;
+	uint16_t head;
+	uint16_t count;
+} ConsoleRamSink;
+
+void ConsoleRamSinkInit(ConsoleRamSink *sink, uint8_t *buf, uint16_t size);
+/* Moves up to len of the oldest bytes to data, returns how many. */
+uint16_t ConsoleRamSinkRead(ConsoleRamSink *sink, uint8_t *data, uint16_t len);
+
+/* Argument types of a log call taken from the C types with _Generic, four
+ * bits each. Tokenized messages and deferred records copy the arguments by
+ * these, the format is not read at the call. */
+#define CONSOLE_ARG_INT			1
+#define CONSOLE_ARG_UINT		2
+#define CONSOLE_ARG_LONG		3
+#define CONSOLE_ARG_ULONG		4
+#define CONSOLE_ARG_LLONG		5
+#define CONSOLE_ARG_ULLONG		6
+#define CONSOLE_ARG_DOUBLE		7
+#define CONSOLE_ARG_STRING		8
+#define CONSOLE_ARG_POINTER		9
+
+#define CONSOLE_ARG_TYPE(x)		((uint32_t)_Generic((x), \
+	char: CONSOLE_ARG_INT, signed char: CONSOLE_ARG_INT, short: CONSOLE_ARG_INT, int: CONSOLE_ARG_INT, _Bool: CONSOLE_ARG_INT, \
+	unsigned char: CONSOLE_ARG_UINT, unsigned short: CONSOLE_ARG_UINT, unsigned int: CONSOLE_ARG_UINT, \
+	long: CONSOLE_ARG_LONG, unsigned long: CONSOLE_ARG_ULONG, \
+	long long: CONSOLE_ARG_LLONG, unsigned long long: CONSOLE_ARG_ULLONG, \
+	float: CONSOLE_ARG_DOUBLE, double: CONSOLE_ARG_DOUBLE, \
+	char *: CONSOLE_ARG_STRING, const char *: CONSOLE_ARG_STRING, \
+	default: CONSOLE_ARG_POINTER))
+
+#define CONSOLE_NARG(...)		CONSOLE_NARG_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define CONSOLE_NARG_(z, a, b, c, d, e, f, g, h, n, ...)	n
+#define CONSOLE_CAT(a, b)		CONSOLE_CAT_(a, b)
+#define CONSOLE_CAT_(a, b)		a##b
+
+#define CONSOLE_TYPES(...)		CONSOLE_CAT(CONSOLE_TYPES_, CONSOLE_NARG(__VA_ARGS__))(__VA_ARGS__)
+#define CONSOLE_TYPES_0()					0
+#define CONSOLE_TYPES_1(a)					CONSOLE_ARG_TYPE(a)
+#define CONSOLE_TYPES_2(a, b)				(CONSOLE_TYPES_1(a) | (CONSOLE_ARG_TYPE(b) << 4))
+#define CONSOLE_TYPES_3(a, b, c)			(CONSOLE_TYPES_2(a, b) | (CONSOLE_ARG_TYPE(c) << 8))
+#define CONSOLE_TYPES_4(a, b, c, d)			(CONSOLE_TYPES_3(a, b, c) | (CONSOLE_ARG_TYPE(d) << 12))
+#define CONSOLE_TYPES_5(a, b, c, d, e)		(CONSOLE_TYPES_4(a, b, c, d) | (CONSOLE_ARG_TYPE(e) << 16))
+#define CONSOLE_TYPES_6(a, b, c, d, e, f)	(CONSOLE_TYPES_5(a, b, c, d, e) | (CONSOLE_ARG_TYPE(f) << 20))
+#define CONSOLE_TYPES_7(a, b, c, d, e, f, g)	(CONSOLE_TYPES_6(a, b, c, d, e, f) | (CONSOLE_ARG_TYPE(g) << 24))
+#define CONSOLE_TYPES_8(a, b, c, d, e, f, g, h)	(CONSOLE_TYPES_7(a, b, c, d, e, f, g) | (CONSOLE_ARG_TYPE(h) << 28))
+
+#if CONFIG_CONSOLE_TOKENIZED
+/* Tokenized output: the format string goes to the console_tokens section and
+ * only its offset, the channel index and the arguments are sent. The host
+ * tool tools/console_decode prints the text again. */
+
+/* The string is never read on the target, see console_tokens.ld. */
+#define CONSOLE_TOKEN(str)		(__extension__({ static const char console_token_[] __attribute__((section("console_tokens"), used)) = str; console_token_; }))
+
+void ConsoleLogToken(ConsoleChannel ch, uint8_t level, const char *token, uint32_t types, ...);
+
+#define CONSOLE_LOG(ch, level, str)				(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogToken((ch), (level), CONSOLE_TOKEN(str), 0) : (void)0)
+#define CONSOLE_LOGF(ch, level, format, ...)	(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogToken((ch), (level), CONSOLE_TOKEN(format), CONSOLE_TYPES(__VA_ARGS__), ##__VA_ARGS__) : (void)0)
+#else
+/* str and format must come from CONSOLE_STR(). Use the macros below. */
+void ConsoleLog(ConsoleChannel ch, uint8_t level, const char *str);
+void ConsoleLogf(ConsoleChannel ch, uint8_t level, const char *format, ...);
+
+/* A record keeps CONFIG_CONSOLE_MAX_ARGS arguments, more do not compile. */
+#define CONSOLE_RECORD_TYPES(...)	(__extension__({ _Static_assert(CONSOLE_NARG(__VA_ARGS__) <= CONFIG_CONSOLE_MAX_ARGS, "more arguments than CONFIG_CONSOLE_MAX_ARGS"); CONSOLE_TYPES(__VA_ARGS__); }))
+
+#define CONSOLE_LOG(ch, level, str)				(ConsoleLevelEnabled((ch), (level)) ? ConsoleLog((ch), (level), CONSOLE_STR(str)) : (void)0)
+#if CONFIG_CONSOLE_DEFERRED
+/* ConsoleLogf reads the types from the format, the macro passes them. */
+void ConsoleLogTyped(ConsoleChannel ch, uint8_t level, const char *format, uint32_t types, ...);
+
+#define CONSOLE_LOGF(ch, level, format, ...)	(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogTyped((ch), (level), CONSOLE_STR(format), CONSOLE_RECORD_TYPES(__VA_ARGS__), ##__VA_ARGS__) : (void)0)
+#else
+#define CONSOLE_LOGF(ch, level, format, ...)	(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogf((ch), (level), CONSOLE_STR(format), ##__VA_ARGS__) : (void)0)
+#endif
+#endif
+
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_TRACE
+#define ConsoleTrace(ch, trace)				CONSOLE_LOG(ch, CONSOLE_LEVEL_TRACE, trace)
+#define ConsoleTracef(ch, format, ...)		CONSOLE_LOGF(ch, CONSOLE_LEVEL_TRACE, format, ##__VA_ARGS__)
+#else
+#define ConsoleTrace(ch, trace)				((void)(ch))
+#define ConsoleTracef(ch, format, ...)		((void)(ch))
+#endif
+
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_DEBUG
+#define ConsoleDebug(ch, debug)				CONSOLE_LOG(ch, CONSOLE_LEVEL_DEBUG, debug)
+#define ConsoleDebugf(ch, format, ...)		CONSOLE_LOGF(ch, CONSOLE_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define ConsoleDebug(ch, debug)				((void)(ch))
+#define ConsoleDebugf(ch, format, ...)		((void)(ch))
+#endif
+
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_INFO
+#define ConsoleInfo(ch, info)				CONSOLE_LOG(ch, CONSOLE_LEVEL_INFO, info)
+#define ConsoleInfof(ch, format, ...)		CONSOLE_LOGF(ch, CONSOLE_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define ConsoleInfo(ch, info)				((void)(ch))
+#define ConsoleInfof(ch, format, ...)		((void)(ch))
+#endif
+
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_WARN
+#define ConsoleWarning(ch, warning)			CONSOLE_LOG(ch, CONSOLE_LEVEL_WARN, warning)
+#define ConsoleWarnf(ch, format, ...)		CONSOLE_LOGF(ch, CONSOLE_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define ConsoleWarning(ch, warning)			((void)(ch))
+#define ConsoleWarnf(ch, format, ...)		((void)(ch))
+#endif
+
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_ERROR
+#define ConsoleError(ch, error)				CONSOLE_LOG(ch, CONSOLE_LEVEL_ERROR, error)
+#define ConsoleErrorf(ch, format, ...)		CONSOLE_LOGF(ch, CONSOLE_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define ConsoleError(ch, error)				((void)(ch))
+#define ConsoleErrorf(ch, format, ...)		((void)(ch))
+#endif
+
+/* Hex dump of len bytes: offset, hex and ASCII, CONFIG_CONSOLE_DUMP_WIDTH
+ * bytes per line. Tokenized and framed output sends the raw bytes, 16 per
+ * record. Formatted on the caller's stack, also in deferred mode. */
+void ConsoleDump(ConsoleChannel ch, uint8_t level, const void *data, uint16_t len);
+
+#define CONSOLE_DUMP(ch, level, data, len)		(((level) >= CONFIG_CONSOLE_MIN_LEVEL && ConsoleLevelEnabled((ch), (level))) ? ConsoleDump((ch), (level), (data), (len)) : (void)0)
+
+#if CONFIG_CONSOLE_ISR_LOG
+/* Interrupt safe variants. They never block, the message is printed later by
+ * the console log task. Return true when a higher priority task was woken,
+ * the caller should then yield before leaving the ISR. */
+#if CONFIG_CONSOLE_TOKENIZED
+bool ConsoleLogTokenFromISR(ConsoleChannel ch, uint8_t level, const char *token, uint32_t types, ...);
+
+#define CONSOLE_LOG_FROM_ISR(ch, level, str)			(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogTokenFromISR((ch), (level), CONSOLE_TOKEN(str), 0) : false)
+#define CONSOLE_LOGF_FROM_ISR(ch, level, format, ...)	(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogTokenFromISR((ch), (level), CONSOLE_TOKEN(format), CONSOLE_TYPES(__VA_ARGS__), ##__VA_ARGS__) : false)
+#else
+bool ConsoleLogFromISR(ConsoleChannel ch, uint8_t level, const char *str);
+bool ConsoleLogfFromISR(ConsoleChannel ch, uint8_t level, const char *format, ...);
+bool ConsoleLogTypedFromISR(ConsoleChannel ch, uint8_t level, const char *format, uint32_t types, ...);
+
+#define CONSOLE_LOG_FROM_ISR(ch, level, str)			(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogFromISR((ch), (level), CONSOLE_STR(str)) : false)
+#define CONSOLE_LOGF_FROM_ISR(ch, level, format, ...)	(ConsoleLevelEnabled((ch), (level)) ? ConsoleLogTypedFromISR((ch), (level), CONSOLE_STR(format), CONSOLE_RECORD_TYPES(__VA_ARGS__), ##__VA_ARGS__) : false)
+#endif
+
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_INFO
+#define ConsoleInfoFromISR(ch, info)			CONSOLE_LOG_FROM_ISR(ch, CONSOLE_LEVEL_INFO, info)
+#define ConsoleInfofFromISR(ch, format, ...)	CONSOLE_LOGF_FROM_ISR(ch, CONSOLE_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define ConsoleInfoFromISR(ch, info)			((void)(ch), false)
+#define ConsoleInfofFromISR(ch, format, ...)	((void)(ch), false)
+#endif
+
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_WARN
+#define ConsoleWarningFromISR(ch, warning)		CONSOLE_LOG_FROM_ISR(ch, CONSOLE_LEVEL_WARN, warning)
+#define ConsoleWarnfFromISR(ch, format, ...)	CONSOLE_LOGF_FROM_ISR(ch, CONSOLE_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define ConsoleWarningFromISR(ch, warning)		((void)(ch), false)
+#define ConsoleWarnfFromISR(ch, format, ...)	((void)(ch), false)
+#endif
 
-void ConsoleError(ConsoleChannel ch, const char *error);
-void ConsoleInfo(ConsoleChannel ch, const char *info);
-void ConsoleWarning(ConsoleChannel ch, const char *warning);
-void ConsoleInfof(ConsoleChannel ch, const char *format, ...);
-void ConsoleErrorf(ConsoleChannel ch, const char *format, ...);
-void ConsoleWarnf(ConsoleChannel ch, const char *format, ...);
+#if CONFIG_CONSOLE_MIN_LEVEL <= CONSOLE_LEVEL_ERROR
+#define ConsoleErrorFromISR(ch, error)			CONSOLE_LOG_FROM_ISR(ch, CONSOLE_LEVEL_ERROR, error)
+#define ConsoleErrorfFromISR(ch, format, ...)	CONSOLE_LOGF_FROM_ISR(ch, CONSOLE_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define ConsoleErrorFromISR(ch, error)			((void)(ch), false)
+#define ConsoleErrorfFromISR(ch, format, ...)	((void)(ch), false)
+#endif
+#endif
 
 
 
@@ -0,0 +1,66 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Run time counter of the FreeRTOS task statistics on the ATmega328P, used
+ * with CONFIG_CONSOLE_TASKS. Timer2 counts at F_CPU / 64 (8 us at 8 MHz), its
+ * overflow interrupt extends it to 32 bits. Timer1 carries the tick. */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "FreeRTOS.h"
+
+#if CONFIG_CONSOLE_TASKS
+
+static volatile uint32_t console_run_time_high;
+
+void ConsoleRunTimeInit(void)
+{
+	TCCR2A = 0;
+	TCNT2 = 0;
+	TIFR2 = 1 << TOV2;
+	TIMSK2 = 1 << TOIE2;
+	TCCR2B = 1 << CS22;
+}
+
+/* Called by the kernel at every context switch. */
+uint32_t ConsoleRunTimeCounter(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t high = console_run_time_high;
+	uint8_t low = TCNT2;
+	/* Overflowed after interrupts were masked, the ISR has not counted it yet. */
+	if ((TIFR2 & (1 << TOV2)) && low != 0xFF)
+		high += 0x100;
+	SREG = sreg;
+	return high | low;
+}
+
+ISR(TIMER2_OVF_vect)
+{
+	console_run_time_high += 0x100;
+}
+
+#endif
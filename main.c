@@ -33,6 +33,20 @@
 
 ConsoleChannel main_con;
 
+#if CONFIG_STATIC_ALLOCATION
+static StaticTask_t test_task;
+static StackType_t test_stack[configMINIMAL_STACK_SIZE + CONSOLE_LOG_STACK];
+static StaticTask_t idle_task;
+static StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+
+void vApplicationGetIdleTaskMemory(StaticTask_t ** tcb, StackType_t ** stack, uint32_t * stack_size)
+{
+	*tcb = &idle_task;
+	*stack = idle_stack;
+	*stack_size = configMINIMAL_STACK_SIZE;
+}
+#endif
+
 void TestTask(void * param)
 {
 	DDRB |= 1 << PORTB0;
@@ -46,15 +60,13 @@ void TestTask(void * param)
 
 void MainDebugHandler(char * reply, const char ** lst, uint16_t len)
 {
-	if(strcmp(lst[0], "echo") == 0)
+	if(len > 1 && strcmp(lst[0], "echo") == 0)
 	{
-		strcpy(reply, lst[1]);
+		ConsoleReplyf("%s", lst[1]);
 	}
 	else
 	{
-		strcpy(reply, "Unknown command <");
-		strcat(reply, lst[0]);
-		strcat(reply, ">.");
+		ConsoleReplyf("Unknown command <%s>.", (len > 0) ? lst[0] : "");
 	}
 }
 
@@ -62,7 +74,11 @@ int main(void)
 {
 	ConsoleInit();
 	main_con = ConsoleCreate("MAIN", MainDebugHandler);
-	xTaskCreate(TestTask, "", configMINIMAL_STACK_SIZE, NULL, 1, NULL);
+#if CONFIG_STATIC_ALLOCATION
+	xTaskCreateStatic(TestTask, "", configMINIMAL_STACK_SIZE + CONSOLE_LOG_STACK, NULL, 1, test_stack, &test_task);
+#else
+	xTaskCreate(TestTask, "", configMINIMAL_STACK_SIZE + CONSOLE_LOG_STACK, NULL, 1, NULL);
+#endif
 	vTaskStartScheduler();    
     while (1) 
     {
@@ -0,0 +1,62 @@
+/*
+	FreeRTOS configuration of the Linux host build, used with the POSIX port
+	of the FreeRTOS kernel. Task priorities and the tick rate match the AVR
+	configuration in the project root so timing behaves the same.
+*/
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#include <stdint.h>
+#include "config.h"
+
+#define configUSE_PREEMPTION		1
+#define configUSE_IDLE_HOOK			0
+#define configUSE_TICK_HOOK			0
+#define configTICK_RATE_HZ			( ( TickType_t ) 1000 )
+/* One above the AVR build for the UsartIO task. */
+#define configMAX_PRIORITIES		( 5 )
+/* Words; threads get at least PTHREAD_STACK_MIN bytes. */
+#define configMINIMAL_STACK_SIZE	( ( unsigned short ) 2048 )
+#define configTOTAL_HEAP_SIZE		( ( size_t ) ( 256 * 1024 ) )
+#define configMAX_TASK_NAME_LEN		( 16 )
+#define configUSE_TRACE_FACILITY	CONFIG_CONSOLE_TASKS
+#define configUSE_16_BIT_TICKS		0
+#define configIDLE_SHOULD_YIELD		1
+#define configQUEUE_REGISTRY_SIZE	0
+#define configUSE_MUTEXES			1
+#define configCHECK_FOR_STACK_OVERFLOW	0
+#define configUSE_MALLOC_FAILED_HOOK	0
+/* The console and usart follow CONFIG_STATIC_ALLOCATION, the port keeps the
+ * heap for its IO task. uint32_t matches the idle task memory hook of V10
+ * and V11. */
+#define configSUPPORT_STATIC_ALLOCATION	CONFIG_STATIC_ALLOCATION
+#define configSTACK_DEPTH_TYPE			uint32_t
+
+/* CPU time per task for CONSOLE TASKS, see console_runtime_linux.c. */
+#define configGENERATE_RUN_TIME_STATS	CONFIG_CONSOLE_TASKS
+#if CONFIG_CONSOLE_TASKS
+void ConsoleRunTimeInit(void);
+uint32_t ConsoleRunTimeCounter(void);
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()	ConsoleRunTimeInit()
+#define portGET_RUN_TIME_COUNTER_VALUE()			ConsoleRunTimeCounter()
+#endif
+
+/* Co-routine definitions. */
+#define configUSE_CO_ROUTINES 		0
+#define configMAX_CO_ROUTINE_PRIORITIES ( 2 )
+
+/* Set the following definitions to 1 to include the API function, or zero
+to exclude the API function. */
+
+#define INCLUDE_vTaskPrioritySet		0
+#define INCLUDE_uxTaskPriorityGet		0
+#define INCLUDE_vTaskDelete				1
+#define INCLUDE_vTaskCleanUpResources	0
+#define INCLUDE_vTaskSuspend			1
+#define INCLUDE_vTaskDelayUntil			1
+#define INCLUDE_vTaskDelay				1
+#define INCLUDE_xTaskGetCurrentTaskHandle	1
+
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* File backed console sink for the Linux host build. */
+
+#include <stdio.h>
+
+#include "console_file_sink.h"
+
+
+static void ConsoleFileSinkWrite(ConsoleSink *sink, const uint8_t *data, uint16_t len)
+{
+	fwrite(data, 1, len, ((ConsoleFileSink *)sink)->file);
+}
+
+bool ConsoleFileSinkOpen(ConsoleFileSink *sink, const char *path, uint8_t level_mask)
+{
+	sink->file = fopen(path, "ab");
+	if (sink->file == NULL)
+		return false;
+	setvbuf(sink->file, NULL, _IOLBF, BUFSIZ);
+	sink->base.write = ConsoleFileSinkWrite;
+	sink->base.space = NULL;
+	if (ConsoleAddSink(&sink->base, level_mask) == false)
+	{
+		fclose(sink->file);
+		sink->file = NULL;
+		return false;
+	}
+	return true;
+}
+
+void ConsoleFileSinkFlush(ConsoleFileSink *sink)
+{
+	if (sink->file != NULL)
+		fflush(sink->file);
+}
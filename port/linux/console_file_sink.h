@@ -0,0 +1,44 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CONSOLE_FILE_SINK_INCLUDE_H_
+#define CONSOLE_FILE_SINK_INCLUDE_H_
+
+#include <stdio.h>
+#include "console.h"
+
+/* Console sink that appends to a file on the host. stdio buffers it and
+ * writes at every line ending, so the file can be followed with tail -f. */
+typedef struct
+{
+	ConsoleSink base;
+	FILE *file;
+}ConsoleFileSink;
+
+/* Opens path for appending and adds the sink with level_mask. */
+bool ConsoleFileSinkOpen(ConsoleFileSink *sink, const char *path, uint8_t level_mask);
+void ConsoleFileSinkFlush(ConsoleFileSink *sink);
+
+
+#endif /* CONSOLE_FILE_SINK_INCLUDE_H_ */
@@ -0,0 +1,91 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Host version of main.c: the same MAIN channel on USART0, which is a pty
+ * here. Connect with e.g. "picocom /dev/pts/N" using the path printed at start.
+ * "console <file>" also appends every message to file. */
+
+#include <stdio.h>
+#include <string.h>
+#include "usart.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "console.h"
+#include "console_file_sink.h"
+
+
+ConsoleChannel main_con;
+ConsoleFileSink file_sink;
+
+#if CONFIG_STATIC_ALLOCATION
+static StaticTask_t test_task;
+static StackType_t test_stack[configMINIMAL_STACK_SIZE + CONSOLE_LOG_STACK];
+static StaticTask_t idle_task;
+static StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+
+void vApplicationGetIdleTaskMemory(StaticTask_t ** tcb, StackType_t ** stack, uint32_t * stack_size)
+{
+	*tcb = &idle_task;
+	*stack = idle_stack;
+	*stack_size = configMINIMAL_STACK_SIZE;
+}
+#endif
+
+void TestTask(void * param)
+{
+	while(1)
+	{
+		ConsoleInfo(main_con, "Hello! This is a test.");
+		vTaskDelay(1000);
+	}
+}
+
+void MainDebugHandler(char * reply, const char ** lst, uint16_t len)
+{
+	if(len > 1 && strcmp(lst[0], "echo") == 0)
+	{
+		ConsoleReplyf("%s", lst[1]);
+	}
+	else
+	{
+		ConsoleReplyf("Unknown command <%s>.", (len > 0) ? lst[0] : "");
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	ConsoleInit();
+	if(argc > 1 && ConsoleFileSinkOpen(&file_sink, argv[1], CONSOLE_MASK_ALL | CONSOLE_MASK_REPLY) == false)
+	{
+		perror(argv[1]);
+	}
+	main_con = ConsoleCreate("MAIN", MainDebugHandler);
+#if CONFIG_STATIC_ALLOCATION
+	xTaskCreateStatic(TestTask, "Test", configMINIMAL_STACK_SIZE + CONSOLE_LOG_STACK, NULL, 1, test_stack, &test_task);
+#else
+	xTaskCreate(TestTask, "Test", configMINIMAL_STACK_SIZE + CONSOLE_LOG_STACK, NULL, 1, NULL);
+#endif
+	vTaskStartScheduler();
+	return 1;
+}
@@ -0,0 +1,193 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Linux backend of usart.c for the FreeRTOS POSIX port. Every port is the
+ * master side of a pseudo-terminal. A high priority task stands in for the
+ * TX and RX interrupts and moves bytes between the rings and the pty. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+#include "usart_port.h"
+#include "usart_linux.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+#define USART_LINUX_CHUNK	64
+
+typedef struct
+{
+	int fd;
+	bool is_open;
+	BaudRate baud;
+	char name[32];
+	/* Popped from the TX ring but not yet taken by the pty. */
+	uint8_t pending[USART_LINUX_CHUNK];
+	uint16_t pending_len;
+	uint16_t pending_pos;
+}UsartPty;
+
+static UsartPty ptys[CONFIG_MAX_NUMBER_OF_USART];
+static TaskHandle_t io_task;
+
+static void UsartIoTask(void * param);
+
+bool UsartPortInit(UsartId id, BaudRate baud)
+{
+	UsartPty * pty = &ptys[id];
+	struct termios tio;
+
+	pty->fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pty->fd < 0)
+		return false;
+	if (grantpt(pty->fd) != 0 || unlockpt(pty->fd) != 0 || ptsname_r(pty->fd, pty->name, sizeof(pty->name)) != 0)
+	{
+		close(pty->fd);
+		pty->fd = -1;
+		return false;
+	}
+	/* Raw bytes both ways, like the wire. */
+	if (tcgetattr(pty->fd, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		tcsetattr(pty->fd, TCSANOW, &tio);
+	}
+	fcntl(pty->fd, F_SETFL, fcntl(pty->fd, F_GETFL) | O_NONBLOCK);
+	pty->baud = baud;
+	pty->is_open = true;
+	pty->pending_len = 0;
+	pty->pending_pos = 0;
+	fprintf(stderr, "usart%d: %s\n", (int)id, pty->name);
+
+	if (io_task == NULL)
+		xTaskCreate(UsartIoTask, "UsartIO", configMINIMAL_STACK_SIZE, NULL, configMAX_PRIORITIES - 1, &io_task);
+	return true;
+}
+
+/* Called from the writing task outside any critical section, the IO task
+ * runs at once. A paced port is drained by the tick only. */
+void UsartPortStartTx(UsartId id)
+{
+	(void)id;
+#if CONFIG_USART_LINUX_PACED == 0
+	if (io_task != NULL)
+		xTaskNotifyGive(io_task);
+#endif
+}
+
+const char * UsartLinuxDevice(UsartId id)
+{
+	if (id >= CONFIG_MAX_NUMBER_OF_USART || ptys[id].is_open == false)
+		return NULL;
+	return ptys[id].name;
+}
+
+/* Bytes one port may move per tick: unlimited, or what its baud rate would
+ * carry with 10 bits per byte. */
+static uint16_t UsartBudget(const UsartPty * pty)
+{
+#if CONFIG_USART_LINUX_PACED
+	static const uint32_t usart_bps[] = { 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+	uint32_t bytes = usart_bps[pty->baud] / 10 / configTICK_RATE_HZ;
+	return (bytes == 0) ? 1 : (uint16_t)bytes;
+#else
+	(void)pty;
+	return 0xFFFF;
+#endif
+}
+
+static bool UsartPollRx(UsartId id, UsartPty * pty, uint16_t budget, BaseType_t * woken)
+{
+	uint8_t buf[USART_LINUX_CHUNK];
+	if (budget > sizeof(buf))
+		budget = sizeof(buf);
+	ssize_t n = read(pty->fd, buf, budget);
+	if (n <= 0)
+		return false;
+	taskENTER_CRITICAL();
+	for (ssize_t i = 0; i < n; i++)
+		UsartRxPushFromISR(id, buf[i], woken);
+	taskEXIT_CRITICAL();
+	return true;
+}
+
+static bool UsartPollTx(UsartId id, UsartPty * pty, uint16_t budget, BaseType_t * woken)
+{
+	if (pty->pending_pos == pty->pending_len)
+	{
+		uint16_t len = 0;
+		if (budget > sizeof(pty->pending))
+			budget = sizeof(pty->pending);
+		taskENTER_CRITICAL();
+		while (len < budget && UsartTxPopFromISR(id, &pty->pending[len], woken))
+			len++;
+		taskEXIT_CRITICAL();
+		pty->pending_len = len;
+		pty->pending_pos = 0;
+		if (len == 0)
+			return false;
+	}
+	/* Nobody has the slave open, or it is not reading: keep the bytes and
+	 * let the ring fill up, as a stalled link would. */
+	ssize_t n = write(pty->fd, &pty->pending[pty->pending_pos], pty->pending_len - pty->pending_pos);
+	if (n <= 0)
+		return false;
+	pty->pending_pos += n;
+	return true;
+}
+
+static void UsartIoTask(void * param)
+{
+	while (true)
+	{
+		BaseType_t wake_token = pdFALSE;
+		bool busy = false;
+		for (uint8_t id = 0; id < CONFIG_MAX_NUMBER_OF_USART; id++)
+		{
+			UsartPty * pty = &ptys[id];
+			if (pty->is_open == false)
+				continue;
+			uint16_t budget = UsartBudget(pty);
+			busy |= UsartPollRx(id, pty, budget, &wake_token);
+			busy |= UsartPollTx(id, pty, budget, &wake_token);
+		}
+		if (wake_token != pdFALSE)
+			taskYIELD();
+#if CONFIG_USART_LINUX_PACED
+		vTaskDelay(1);
+#else
+		if (busy == false)
+			ulTaskNotifyTake(pdTRUE, 1);
+#endif
+	}
+}
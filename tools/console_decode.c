@@ -0,0 +1,367 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Host decoder of the binary console output (CONFIG_CONSOLE_TOKENIZED and
+ * CONFIG_CONSOLE_FRAMED).
+ *
+ *	objcopy --dump-section console_tokens=tokens.bin firmware.elf
+ *	console_decode [-f] [-t tokens.bin] [-i 16] [-l 32] [input]
+ *
+ * Reads the byte stream from input (a file, a tty or stdin) and prints one
+ * text line per record, in the same form as the text console. -f reads COBS
+ * frames, each line then starts with the tick of the message. -t is needed
+ * for tokenized messages. -i and -l give the width of int and long on the
+ * target (AVR: 16 and 32, the defaults), so %u and %x print the same digits
+ * the target would. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "console_frame.h"
+
+#define WIRE_START		0x1E
+#define WIRE_TOKEN		0x00
+#define WIRE_TEXT		0x10
+#define WIRE_CHANNEL	0x20
+#define WIRE_DUMP		0x30
+
+typedef struct
+{
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	int error;
+}Reader;
+
+static char * tokens;
+static size_t tokens_len;
+static char keys[256][16];
+static int int_bits = 16;
+static int long_bits = 32;
+
+static const char * const levels[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "REPLY" };
+
+static uint64_t ReadVarint(Reader * r)
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (r->pos >= r->len)
+		{
+			r->error = 1;
+			return 0;
+		}
+		uint8_t b = r->data[r->pos++];
+		value |= (uint64_t)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			break;
+	}
+	return value;
+}
+
+static int64_t ReadSigned(Reader * r)
+{
+	uint64_t v = ReadVarint(r);
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static float ReadFloat(Reader * r)
+{
+	uint32_t bits = 0;
+	float f;
+	if (r->pos + 4 > r->len)
+	{
+		r->error = 1;
+		return 0;
+	}
+	for (int i = 0; i < 4; i++)
+		bits |= (uint32_t)r->data[r->pos++] << (8 * i);
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+/* Print format with the arguments from r, one conversion at a time. */
+static void PrintToken(FILE * out, const char * format, Reader * r)
+{
+	while (*format != 0)
+	{
+		if (*format != '%')
+		{
+			fputc(*format++, out);
+			continue;
+		}
+		if (format[1] == '%')
+		{
+			fputc('%', out);
+			format += 2;
+			continue;
+		}
+		if (r->pos >= r->len)
+		{
+			/* The target left out arguments that did not fit. */
+			fputs("<?>", out);
+			break;
+		}
+
+		/* Flags, width and precision are kept, length modifiers replaced. */
+		char spec[32];
+		size_t n = 0;
+		int bits = int_bits;
+		spec[n++] = *format++;
+		while (*format != 0 && strchr("-+ #0123456789.*", *format) != NULL && n < sizeof(spec) - 4)
+			spec[n++] = *format++;
+		while (*format != 0 && strchr("hlLqjzt", *format) != NULL)
+		{
+			if (*format == 'l')
+				bits = (bits == long_bits) ? 64 : long_bits;
+			else if (*format == 'j' || *format == 'z' || *format == 't' || *format == 'q' || *format == 'L')
+				bits = 64;
+			format++;
+		}
+		char conv = *format;
+		if (conv == 0)
+			break;
+		format++;
+
+		switch (conv)
+		{
+			case 'd':
+			case 'i':
+			{
+				int64_t v = ReadSigned(r);
+				if (bits < 64)
+					v = (int64_t)((uint64_t)v << (64 - bits)) >> (64 - bits);
+				strcpy(&spec[n], "lld");
+				fprintf(out, spec, (long long)v);
+				break;
+			}
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+			{
+				uint64_t v = (uint64_t)ReadSigned(r);
+				if (bits < 64)
+					v &= (1ull << bits) - 1;
+				spec[n++] = 'l';
+				spec[n++] = 'l';
+				spec[n++] = conv;
+				spec[n] = 0;
+				fprintf(out, spec, (unsigned long long)v);
+				break;
+			}
+			case 'c':
+				spec[n++] = 'c';
+				spec[n] = 0;
+				fprintf(out, spec, (int)ReadSigned(r));
+				break;
+			case 'p':
+				fprintf(out, "0x%llx", (unsigned long long)ReadSigned(r));
+				break;
+			case 's':
+			{
+				size_t len = (r->pos < r->len) ? r->data[r->pos++] : 0;
+				if (r->pos + len > r->len)
+				{
+					r->error = 1;
+					len = r->len - r->pos;
+				}
+				char str[256];
+				memcpy(str, &r->data[r->pos], len);
+				str[len] = 0;
+				r->pos += len;
+				spec[n++] = 's';
+				spec[n] = 0;
+				fprintf(out, spec, str);
+				break;
+			}
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+				spec[n++] = conv;
+				spec[n] = 0;
+				fprintf(out, spec, (double)ReadFloat(r));
+				break;
+			default:
+				fputc('%', out);
+				fputc(conv, out);
+				break;
+		}
+	}
+}
+
+/* Same layout as the text dump of the target, 16 bytes per line. */
+static void PrintDump(FILE * out, Reader * r)
+{
+	if (r->len < 2)
+	{
+		fputs("<truncated>", out);
+		return;
+	}
+	fprintf(out, "%04x  ", r->data[0] | (r->data[1] << 8));
+	for (size_t i = 2; i < 18; i++)
+	{
+		if (i < r->len)
+			fprintf(out, "%02x ", r->data[i]);
+		else
+			fputs("   ", out);
+	}
+	fputc(' ', out);
+	for (size_t i = 2; i < r->len; i++)
+		fputc((r->data[i] >= ' ' && r->data[i] < 0x7F) ? r->data[i] : '.', out);
+}
+
+static const char * ChannelKey(uint8_t index, char * buf)
+{
+	if (keys[index][0] != 0)
+		return keys[index];
+	sprintf(buf, "#%u", index);
+	return buf;
+}
+
+static void DecodeRecord(FILE * out, uint8_t kind, uint8_t level, uint8_t channel, const uint8_t * body, size_t len)
+{
+	char unknown[8];
+	Reader r = { body, len, 0, 0 };
+
+	if (kind == WIRE_CHANNEL)
+	{
+		size_t n = (r.len < sizeof(keys[0]) - 1) ? r.len : sizeof(keys[0]) - 1;
+		memcpy(keys[channel], r.data, n);
+		keys[channel][n] = 0;
+		return;
+	}
+	fprintf(out, ">%s[%s]: ", ChannelKey(channel, unknown), (level < 6) ? levels[level] : "?");
+	if (kind == WIRE_TEXT)
+	{
+		while (r.len > 0 && (r.data[r.len - 1] == '\r' || r.data[r.len - 1] == '\n'))
+			r.len--;
+		fwrite(r.data, 1, r.len, out);
+	}
+	else if (kind == WIRE_TOKEN)
+	{
+		uint64_t id = ReadVarint(&r);
+		if (id < tokens_len)
+			PrintToken(out, &tokens[id], &r);
+		else
+			fprintf(out, "<unknown token %llu>", (unsigned long long)id);
+		if (r.error)
+			fputs(" <truncated>", out);
+	}
+	else if (kind == WIRE_DUMP)
+		PrintDump(out, &r);
+	fputc('\n', out);
+	fflush(out);
+}
+
+static void DecodeFrame(const ConsoleFrameRecord * frame, void * ctx)
+{
+	FILE * out = ctx;
+	if (frame->lost != 0)
+		fprintf(out, "<%u frames lost>\n", frame->lost);
+	if (frame->kind != CONSOLE_FRAME_CHANNEL)
+		fprintf(out, "%lu ", (unsigned long)frame->tick);
+	DecodeRecord(out, frame->kind, frame->level, frame->channel, frame->body, frame->len);
+}
+
+static int LoadTokens(const char * path)
+{
+	FILE * f = fopen(path, "rb");
+	if (f == NULL)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	tokens_len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	tokens = calloc(1, tokens_len + 1);
+	if (fread(tokens, 1, tokens_len, f) != tokens_len)
+		tokens_len = 0;
+	fclose(f);
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	const char * token_path = NULL;
+	int framed = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "ft:i:l:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'f': framed = 1; break;
+			case 't': token_path = optarg; break;
+			case 'i': int_bits = atoi(optarg); break;
+			case 'l': long_bits = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-f] [-t tokens.bin] [-i int_bits] [-l long_bits] [input]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (token_path != NULL && LoadTokens(token_path) != 0)
+	{
+		fprintf(stderr, "cannot read token dictionary\n");
+		return 2;
+	}
+	FILE * in = (optind < argc) ? fopen(argv[optind], "rb") : stdin;
+	if (in == NULL)
+	{
+		perror(argv[optind]);
+		return 2;
+	}
+
+	if (framed)
+	{
+		ConsoleFrameDecoder dec;
+		uint8_t chunk[256];
+		ConsoleFrameInit(&dec, DecodeFrame, stdout);
+		/* read() returns what a tty has so far, fread() would wait for a full chunk. */
+		ssize_t n;
+		while ((n = read(fileno(in), chunk, sizeof(chunk))) > 0)
+			ConsoleFrameFeed(&dec, chunk, n);
+		fprintf(stderr, "%lu frames, %lu damaged, %lu lost\n", dec.frames, dec.damaged, dec.lost);
+		return 0;
+	}
+
+	/* Resynchronise on the start byte after a lost or damaged record. */
+	int c;
+	uint8_t record[256];
+	while ((c = fgetc(in)) != EOF)
+	{
+		if (c != WIRE_START)
+			continue;
+		int len = fgetc(in);
+		if (len == EOF || fread(record, 1, len, in) != (size_t)len)
+			break;
+		if (len >= 2)
+			DecodeRecord(stdout, record[0] & 0xF0, record[0] & 0x0F, record[1], record + 2, len - 2);
+	}
+	return 0;
+}
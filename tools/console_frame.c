@@ -0,0 +1,121 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "console_frame.h"
+
+#define CONSOLE_FRAME_HEADER	8
+
+void ConsoleFrameInit(ConsoleFrameDecoder *dec, ConsoleFrameHandler handler, void *ctx)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->handler = handler;
+	dec->ctx = ctx;
+}
+
+int ConsoleCobsDecode(const uint8_t *in, size_t len, uint8_t *out)
+{
+	size_t pos = 0;
+	size_t n = 0;
+	while (pos < len)
+	{
+		uint8_t code = in[pos++];
+		if (code == 0 || pos + code - 1 > len)
+			return -1;
+		memcpy(&out[n], &in[pos], code - 1);
+		n += code - 1;
+		pos += code - 1;
+		if (code != 0xFF && pos < len)
+			out[n++] = 0;
+	}
+	return (int)n;
+}
+
+uint16_t ConsoleFrameCrc(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < len; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+	}
+	return crc;
+}
+
+static void ConsoleFrameComplete(ConsoleFrameDecoder *dec)
+{
+	uint8_t raw[CONSOLE_FRAME_MAX];
+	int len = ConsoleCobsDecode(dec->buf, dec->fill, raw);
+	if (len < CONSOLE_FRAME_HEADER + 2)
+	{
+		dec->damaged++;
+		return;
+	}
+	uint16_t crc = raw[len - 2] | (uint16_t)raw[len - 1] << 8;
+	if (ConsoleFrameCrc(raw, len - 2) != crc)
+	{
+		dec->damaged++;
+		return;
+	}
+
+	ConsoleFrameRecord frame;
+	frame.kind = raw[0] & 0xF0;
+	frame.level = raw[0] & 0x0F;
+	frame.channel = raw[1];
+	frame.seq = raw[2] | (uint16_t)raw[3] << 8;
+	frame.tick = raw[4] | (uint32_t)raw[5] << 8 | (uint32_t)raw[6] << 16 | (uint32_t)raw[7] << 24;
+	frame.lost = dec->synced ? (uint16_t)(frame.seq - dec->next_seq) : 0;
+	frame.body = &raw[CONSOLE_FRAME_HEADER];
+	frame.len = len - CONSOLE_FRAME_HEADER - 2;
+
+	dec->synced = true;
+	dec->next_seq = frame.seq + 1;
+	dec->frames++;
+	dec->lost += frame.lost;
+	if (dec->handler != NULL)
+		dec->handler(&frame, dec->ctx);
+}
+
+void ConsoleFrameFeed(ConsoleFrameDecoder *dec, const uint8_t *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		if (data[i] != 0)
+		{
+			if (dec->fill < sizeof(dec->buf))
+				dec->buf[dec->fill++] = data[i];
+			else
+				dec->overflow = true;
+			continue;
+		}
+		/* A decoder started in the middle of a frame counts it as damaged. */
+		if (dec->overflow)
+			dec->damaged++;
+		else if (dec->fill != 0)
+			ConsoleFrameComplete(dec);
+		dec->fill = 0;
+		dec->overflow = false;
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Host side decoder of the framed console output (CONFIG_CONSOLE_FRAMED).
+ *
+ * Feed it the raw byte stream in chunks of any size, the handler is called
+ * once for every frame that passed the CRC check. Damaged frames are counted
+ * and skipped, lost frames show up as gaps in the sequence number. */
+
+#ifndef CONSOLE_FRAME_H_
+#define CONSOLE_FRAME_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONSOLE_FRAME_TOKEN		0x00
+#define CONSOLE_FRAME_TEXT		0x10
+#define CONSOLE_FRAME_CHANNEL	0x20
+#define CONSOLE_FRAME_DUMP		0x30
+
+#define CONSOLE_FRAME_MAX		256
+
+typedef struct
+{
+	uint8_t kind;
+	uint8_t level;
+	uint8_t channel;
+	uint16_t seq;
+	uint32_t tick;
+	/* Frames missing between the previous frame and this one. */
+	uint16_t lost;
+	const uint8_t *body;
+	size_t len;
+} ConsoleFrameRecord;
+
+typedef void (*ConsoleFrameHandler)(const ConsoleFrameRecord *frame, void *ctx);
+
+typedef struct
+{
+	ConsoleFrameHandler handler;
+	void *ctx;
+	uint8_t buf[CONSOLE_FRAME_MAX];
+	size_t fill;
+	bool overflow;
+	bool synced;
+	uint16_t next_seq;
+
+	unsigned long frames;
+	unsigned long damaged;
+	unsigned long lost;
+} ConsoleFrameDecoder;
+
+void ConsoleFrameInit(ConsoleFrameDecoder *dec, ConsoleFrameHandler handler, void *ctx);
+void ConsoleFrameFeed(ConsoleFrameDecoder *dec, const uint8_t *data, size_t len);
+
+/* COBS decode in place is not possible, out needs len bytes. Returns the
+ * decoded length or -1 on a malformed block. */
+int ConsoleCobsDecode(const uint8_t *in, size_t len, uint8_t *out);
+uint16_t ConsoleFrameCrc(const uint8_t *data, size_t len);
+
+#endif /* CONSOLE_FRAME_H_ */
@@ -0,0 +1,95 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "console_lz.h"
+
+#define CONSOLE_LZ_MIN_MATCH	3
+
+void ConsoleLzInit(ConsoleLzDecoder *dec, ConsoleLzSink sink, void *ctx)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->sink = sink;
+	dec->ctx = ctx;
+	dec->low = -1;
+}
+
+static void ConsoleLzOutput(ConsoleLzDecoder *dec, uint8_t c, uint8_t *out, size_t *n)
+{
+	dec->window[dec->head] = c;
+	dec->head = (dec->head + 1) % CONSOLE_LZ_WINDOW;
+	out[(*n)++] = c;
+}
+
+void ConsoleLzFeed(ConsoleLzDecoder *dec, const uint8_t *data, size_t len)
+{
+	/* One input byte expands to at most 18 output bytes. */
+	uint8_t out[4096];
+	size_t n = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		uint8_t b = data[i];
+		if (dec->items == 0)
+		{
+			dec->control = b;
+			dec->items = 8;
+			dec->bit = 0;
+			continue;
+		}
+		if ((dec->control & (1 << dec->bit)) == 0)
+		{
+			ConsoleLzOutput(dec, b, out, &n);
+		}
+		else if (dec->low < 0)
+		{
+			dec->low = b;
+			continue;
+		}
+		else
+		{
+			uint16_t distance = dec->low | (uint16_t)(b >> 4) << 8;
+			uint8_t count = (b & 0x0F) + CONSOLE_LZ_MIN_MATCH;
+			dec->low = -1;
+			if (distance == 0)
+			{
+				/* End of the group, a control byte follows. */
+				dec->items = 0;
+				continue;
+			}
+			for (uint8_t k = 0; k < count; k++)
+				ConsoleLzOutput(dec, dec->window[(dec->head + CONSOLE_LZ_WINDOW - distance) % CONSOLE_LZ_WINDOW], out, &n);
+		}
+		dec->bit++;
+		dec->items--;
+
+		if (n > sizeof(out) - 32)
+		{
+			dec->sink(out, n, dec->ctx);
+			n = 0;
+		}
+	}
+	if (n != 0)
+		dec->sink(out, n, dec->ctx);
+}
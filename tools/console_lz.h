@@ -0,0 +1,59 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Host side decompressor of the console output (CONFIG_CONSOLE_COMPRESS).
+ *
+ * The stream has no sync points, the decoder has to see it from the start,
+ * i.e. run it before the target is reset. Its window is always the largest
+ * the format allows, so it works with any CONFIG_CONSOLE_COMPRESS_WINDOW. */
+
+#ifndef CONSOLE_LZ_H_
+#define CONSOLE_LZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONSOLE_LZ_WINDOW		4096
+
+typedef void (*ConsoleLzSink)(const uint8_t *data, size_t len, void *ctx);
+
+typedef struct
+{
+	ConsoleLzSink sink;
+	void *ctx;
+	uint8_t window[CONSOLE_LZ_WINDOW];
+	uint16_t head;
+	uint8_t control;
+	/* Items left in the group, 0: the next byte is a control byte. */
+	uint8_t items;
+	uint8_t bit;
+	int low;
+
+	unsigned long errors;
+} ConsoleLzDecoder;
+
+void ConsoleLzInit(ConsoleLzDecoder *dec, ConsoleLzSink sink, void *ctx);
+void ConsoleLzFeed(ConsoleLzDecoder *dec, const uint8_t *data, size_t len);
+
+#endif /* CONSOLE_LZ_H_ */
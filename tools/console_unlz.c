@@ -0,0 +1,57 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Decompress the console output (CONFIG_CONSOLE_COMPRESS) to stdout.
+ *
+ *	console_unlz [input]
+ *	console_unlz /dev/ttyUSB0 | console_decode -t tokens.bin
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include "console_lz.h"
+
+static void WriteOut(const uint8_t *data, size_t len, void *ctx)
+{
+	fwrite(data, 1, len, stdout);
+	fflush(stdout);
+}
+
+int main(int argc, char ** argv)
+{
+	FILE * in = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+	if (in == NULL)
+	{
+		perror(argv[1]);
+		return 2;
+	}
+
+	ConsoleLzDecoder dec;
+	uint8_t chunk[256];
+	ssize_t n;
+	ConsoleLzInit(&dec, WriteOut, NULL);
+	while ((n = read(fileno(in), chunk, sizeof(chunk))) > 0)
+		ConsoleLzFeed(&dec, chunk, n);
+	return 0;
+}
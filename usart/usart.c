@@ -28,23 +28,62 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
 
 
 #include "usart.h"
+#include "usart_port.h"
 
 #include "FreeRTOS.h"
-#include "queue.h"
+#include "task.h"
+#include "semphr.h"
 
-#ifndef F_CPU 
-#error F_CPU "isn't defined. Please define F_CPU to 8000000UL to make this code working properly."
-#else
-#if F_CPU != 8000000UL
-#error "Please set F_CPU to 8000000UL or add logic for other clock speed."
-#endif
-#endif
 
+/* Single producer / single consumer byte ring. One slot is always kept free,
+ * so head == tail means empty. The ISR owns one index, tasks own the other and
+ * only touch the ring inside a critical section. Writing tasks take writers
+ * first, so only one of them at a time waits in waiter for room. */
+typedef struct
+{
+	uint8_t * buf;
+	uint16_t size;
+	volatile uint16_t head;
+	volatile uint16_t tail;
+	TaskHandle_t volatile waiter;
+	SemaphoreHandle_t writers;
+}UsartRing;
+
+/* Line buffers of line mode. The ISR fills buffer filling, a complete line
+ * sets its bit in ready and the ISR moves on to the other buffer. Both sides
+ * take the buffers in turn, the reader clears the bit of a line when it asks
+ * for the next one. */
+typedef struct
+{
+	uint8_t * buf[2];
+	uint16_t len[2];
+	uint16_t size;
+	uint16_t fill;
+	uint8_t filling;
+	uint8_t reading;
+	bool holding;
+	volatile uint8_t ready;
+	TaskHandle_t volatile waiter;
+}UsartLines;
+
+/* Message ends the writers queued per TX lane. */
+#define USART_MESSAGE_ENDS	8
+
+/* High lane of the TX path. Each lane queues the ring positions where its
+ * messages end, the ISR sends from lane until that lane reaches an end. A
+ * full queue merges the next message into the one before. */
+typedef struct
+{
+	UsartRing high;
+	uint16_t ends[2][USART_MESSAGE_ENDS];
+	volatile uint8_t end_head[2];
+	uint8_t end_tail[2];
+	uint8_t lane;
+	bool busy;
+}UsartLanes;
 
 typedef struct
 {
@@ -52,142 +91,556 @@ typedef struct
 	BaudRate baud;
 	size_t rx_bf_len;
 	size_t tx_bf_len;
-	xQueueHandle rx_queue;
-	xQueueHandle tx_queue;
+	UsartRing rx;
+	UsartRing tx;
+	UsartLines lines;
+	UsartLanes lanes;
+	UsartStats stats;
+#if CONFIG_STATIC_ALLOCATION
+	StaticSemaphore_t writers[2];
+#endif
 	bool is_initialised;	
 }Usart;
 
 Usart * usart[CONFIG_MAX_NUMBER_OF_USART];
 
-UsartHandle UsartInit(UsartId id, BaudRate baud, size_t rx_buf_len, size_t tx_buf_len)
+static uint16_t UsartRingCount(const UsartRing * ring)
+{
+	uint16_t head = ring->head;
+	uint16_t tail = ring->tail;
+	return (head >= tail) ? head - tail : ring->size - tail + head;
+}
+
+static uint16_t UsartRingPut(UsartRing * ring, const uint8_t * data, uint16_t len)
+{
+	uint16_t space = ring->size - 1 - UsartRingCount(ring);
+	uint16_t head = ring->head;
+	if (len > space)
+		len = space;
+	uint16_t first = ring->size - head;
+	if (first > len)
+		first = len;
+	memcpy(&ring->buf[head], data, first);
+	memcpy(ring->buf, &data[first], len - first);
+	head += len;
+	if (head >= ring->size)
+		head -= ring->size;
+	ring->head = head;
+	return len;
+}
+
+static uint16_t UsartRingGet(UsartRing * ring, uint8_t * data, uint16_t len)
+{
+	uint16_t count = UsartRingCount(ring);
+	uint16_t tail = ring->tail;
+	if (len > count)
+		len = count;
+	uint16_t first = ring->size - tail;
+	if (first > len)
+		first = len;
+	memcpy(data, &ring->buf[tail], first);
+	memcpy(&data[first], ring->buf, len - first);
+	tail += len;
+	if (tail >= ring->size)
+		tail -= ring->size;
+	ring->tail = tail;
+	return len;
+}
+
+/* buf holds USART_RING_SIZE(len) bytes. */
+static void UsartRingInit(UsartRing * ring, uint8_t * buf, size_t len)
+{
+	ring->buf = buf;
+	ring->size = len + 1;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->waiter = NULL;
+	ring->writers = NULL;
+}
+
+/* Writer locks are binary semaphores like the console lock, the AVR build
+ * has no configUSE_MUTEXES. A new one starts taken. */
+static SemaphoreHandle_t UsartLockStart(SemaphoreHandle_t lock)
+{
+	if (lock != NULL)
+		xSemaphoreGive(lock);
+	return lock;
+}
+
+/* The rings are set up, reset the rest and start the port. */
+static UsartHandle UsartStart(Usart * usrt, UsartId id, BaudRate baud, size_t rx_buf_len, size_t tx_buf_len)
 {
-	Usart * usrt = NULL;
-	if (id == USART_ID_0)
-	{
-		UCSR0B = (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
-		UCSR0C = (1 << UCSZ00) | (1 << UCSZ01);
-		UBRR0 = 51;
-		
-		if (usart[0] != NULL)
-		{
-			if(usart[0]->is_initialised)
-			{
-				return usart[0];
-			}
-			usrt = usart[0];
-		}
-		else
-		{
-			usart[0] = pvPortMalloc(sizeof(Usart));
-			usrt = usart[0];
-		}
-	}
-	usrt->is_initialised = true;
 	usrt->id = id;
-	usrt->baud = BAUDRATE_9600;
+	usrt->baud = baud;
 	usrt->rx_bf_len = rx_buf_len;
 	usrt->tx_bf_len = tx_buf_len;
-	usrt->rx_queue = xQueueCreate(rx_buf_len, sizeof(uint8_t));
-	usrt->tx_queue = xQueueCreate(tx_buf_len, sizeof(uint8_t));
+	memset(&usrt->lines, 0, sizeof(usrt->lines));
+	memset(&usrt->lanes, 0, sizeof(usrt->lanes));
+	memset(&usrt->stats, 0, sizeof(usrt->stats));
+	if (UsartPortInit(id, baud) != true)
+		return NULL;
+	usrt->is_initialised = true;
 	return usrt;
 }
 
+#if CONFIG_STATIC_ALLOCATION
+
+static Usart usart_static[CONFIG_MAX_NUMBER_OF_USART];
+
+UsartHandle UsartInitStatic(UsartId id, BaudRate baud, uint8_t * rx_buf, size_t rx_buf_len, uint8_t * tx_buf, size_t tx_buf_len)
+{
+	if (id >= CONFIG_MAX_NUMBER_OF_USART)
+		return NULL;
+	Usart * usrt = &usart_static[id];
+	if (usrt->is_initialised)
+		return usrt;
+	if (rx_buf == NULL || tx_buf == NULL)
+		return NULL;
+	UsartRingInit(&usrt->rx, rx_buf, rx_buf_len);
+	UsartRingInit(&usrt->tx, tx_buf, tx_buf_len);
+	usrt->tx.writers = UsartLockStart(xSemaphoreCreateBinaryStatic(&usrt->writers[USART_LANE_LOW]));
+	usart[id] = usrt;
+	return UsartStart(usrt, id, baud, rx_buf_len, tx_buf_len);
+}
+
+#else
+
+static bool UsartRingCreate(UsartRing * ring, size_t len)
+{
+	uint8_t * buf = pvPortMalloc(USART_RING_SIZE(len));
+	UsartRingInit(ring, buf, len);
+	return buf != NULL;
+}
+
+UsartHandle UsartInit(UsartId id, BaudRate baud, size_t rx_buf_len, size_t tx_buf_len)
+{
+	if (id >= CONFIG_MAX_NUMBER_OF_USART)
+		return NULL;
+	if (usart[id] != NULL && usart[id]->is_initialised)
+		return usart[id];
+	if (usart[id] == NULL)
+		usart[id] = pvPortMalloc(sizeof(Usart));
+	Usart * usrt = usart[id];
+	if (usrt == NULL)
+		return NULL;
+	if (UsartRingCreate(&usrt->rx, rx_buf_len) != true || UsartRingCreate(&usrt->tx, tx_buf_len) != true)
+		return NULL;
+	usrt->tx.writers = UsartLockStart(xSemaphoreCreateBinary());
+	if (usrt->tx.writers == NULL)
+		return NULL;
+	return UsartStart(usrt, id, baud, rx_buf_len, tx_buf_len);
+}
+
+#endif
+
 size_t UsartRead(UsartHandle handle, uint8_t * buffer, uint16_t len)
 {
 	if(handle == NULL)
 		return 0;
-	size_t ret;
 	Usart * urt = handle;
-	for(size_t i = 0; i < len; i ++)
+	size_t ret = 0;
+	while (ret < len)
 	{
-		if (xQueueReceive(urt->rx_queue, &buffer[i], 1000) != pdTRUE)
+		taskENTER_CRITICAL();
+		uint16_t n = UsartRingGet(&urt->rx, &buffer[ret], len - ret);
+		if (n == 0)
+			urt->rx.waiter = xTaskGetCurrentTaskHandle();
+		taskEXIT_CRITICAL();
+
+		ret += n;
+		if (n == 0 && ulTaskNotifyTake(pdTRUE, 1000) == 0)
 		{
-			ret = i;
+			urt->rx.waiter = NULL;
 			break;
 		}
 	}
-	ret = len;
 	return ret;
 }
 
 
 bool UsartReadByte(UsartHandle handle, uint8_t * buffer)
 {
-	if(handle == NULL)
-	return false;
-	Usart * urt = handle;
-	if (xQueueReceive(urt->rx_queue, buffer, 1000) == pdTRUE)
-	{
-		return true;
-	}
-	return false;
+	return UsartRead(handle, buffer, 1) == 1;
+}
+
+static UsartRing * UsartLaneRing(Usart * urt, UsartLane lane)
+{
+	return (lane == USART_LANE_HIGH && urt->lanes.high.buf != NULL) ? &urt->lanes.high : &urt->tx;
 }
 
 size_t UsartWrite(UsartHandle handle, const uint8_t * data, uint16_t len)
+{
+	size_t ret = UsartWriteLane(handle, USART_LANE_LOW, data, len);
+	UsartEndMessage(handle, USART_LANE_LOW);
+	return ret;
+}
+
+size_t UsartWriteLane(UsartHandle handle, UsartLane lane, const uint8_t * data, uint16_t len)
 {
 	if(handle == NULL)
 	return 0;
-	size_t ret;
 	Usart * urt = handle;
-	for (size_t i = 0; i < len; i++)
+	UsartRing * ring = UsartLaneRing(urt, lane);
+	uint16_t * peak = (ring == &urt->tx) ? &urt->stats.tx_peak : &urt->stats.tx_high_peak;
+	if (xSemaphoreTake(ring->writers, portMAX_DELAY) == pdFALSE)
+		return 0;
+	size_t ret = 0;
+	while (ret < len)
 	{
-		if(xQueueSend(urt->tx_queue, &data[i], 1000) != pdTRUE)
+		taskENTER_CRITICAL();
+		uint16_t n = UsartRingPut(ring, &data[ret], len - ret);
+		if (n != 0)
 		{
-			ret = i;
-			break;
+			uint16_t count = UsartRingCount(ring);
+			if (count > *peak)
+				*peak = count;
+			urt->stats.tx_bytes += n;
 		}
 		else
 		{
-			UCSR0B |= 1 << UDRE0;
+			urt->stats.tx_waits++;
+			ring->waiter = xTaskGetCurrentTaskHandle();
+		}
+		taskEXIT_CRITICAL();
+
+		/* Outside the critical section, a port may wake a task from here. */
+		if (n != 0)
+			UsartPortStartTx(urt->id);
+		ret += n;
+		if (n == 0 && ulTaskNotifyTake(pdTRUE, 1000) == 0)
+		{
+			taskENTER_CRITICAL();
+			ring->waiter = NULL;
+			taskEXIT_CRITICAL();
+			break;
 		}
 	}
-	ret = len;
+	xSemaphoreGive(ring->writers);
 	return ret;
 }
 
 
 bool UsartWriteByte(UsartHandle handle, const uint8_t data)
+{
+	return UsartWrite(handle, &data, 1) == 1;
+}
+
+size_t UsartWriteString(UsartHandle handle, const char * str)
+{
+	return UsartWrite(handle, (const uint8_t *) str, strlen(str));
+}
+
+size_t UsartWriteSpace(UsartHandle handle)
+{
+	return UsartLaneSpace(handle, USART_LANE_LOW);
+}
+
+size_t UsartLaneSpace(UsartHandle handle, UsartLane lane)
 {
 	if(handle == NULL)
-	return false;
+		return 0;
+	UsartRing * ring = UsartLaneRing(handle, lane);
+	taskENTER_CRITICAL();
+	uint16_t space = ring->size - 1 - UsartRingCount(ring);
+	taskEXIT_CRITICAL();
+	return space;
+}
+
+bool UsartLaneWait(UsartHandle handle, UsartLane lane, uint16_t len, uint16_t ticks)
+{
+	if(handle == NULL)
+		return false;
+	UsartRing * ring = UsartLaneRing(handle, lane);
+	if (len >= ring->size || xSemaphoreTake(ring->writers, ticks) == pdFALSE)
+		return false;
+	TickType_t start = xTaskGetTickCount();
+	bool room;
+	for (;;)
+	{
+		taskENTER_CRITICAL();
+		room = ring->size - 1 - UsartRingCount(ring) >= len;
+		if (room == false)
+			ring->waiter = xTaskGetCurrentTaskHandle();
+		taskEXIT_CRITICAL();
+		TickType_t waited = xTaskGetTickCount() - start;
+		/* The TX interrupt wakes the waiter once half of the ring is free. */
+		if (room || waited >= ticks || ulTaskNotifyTake(pdTRUE, ticks - waited) == 0)
+			break;
+	}
+	if (room == false)
+	{
+		taskENTER_CRITICAL();
+		ring->waiter = NULL;
+		taskEXIT_CRITICAL();
+	}
+	xSemaphoreGive(ring->writers);
+	return room;
+}
+
+static void UsartLanesStart(Usart * urt, uint8_t * buf, size_t high_buf_len, SemaphoreHandle_t writers)
+{
+	UsartRing high;
+	UsartRingInit(&high, buf, high_buf_len);
+	high.writers = writers;
+	taskENTER_CRITICAL();
+	urt->lanes.high = high;
+	taskEXIT_CRITICAL();
+}
+
+#if CONFIG_STATIC_ALLOCATION
+
+bool UsartLanesInitStatic(UsartHandle handle, uint8_t * buf, size_t high_buf_len)
+{
+	if(handle == NULL || buf == NULL)
+		return false;
 	Usart * urt = handle;
-	if(xQueueSend(urt->tx_queue, &data, 1000) == pdTRUE)
-	{ 
-		UCSR0B |= 1 << UDRE0;
+	if (urt->lanes.high.buf == NULL)
+		UsartLanesStart(urt, buf, high_buf_len, UsartLockStart(xSemaphoreCreateBinaryStatic(&urt->writers[USART_LANE_HIGH])));
+	return true;
+}
+
+#else
+
+bool UsartLanesInit(UsartHandle handle, size_t high_buf_len)
+{
+	if(handle == NULL)
+		return false;
+	Usart * urt = handle;
+	if (urt->lanes.high.buf != NULL)
 		return true;
+	uint8_t * buf = pvPortMalloc(USART_RING_SIZE(high_buf_len));
+	if (buf == NULL)
+		return false;
+	SemaphoreHandle_t writers = UsartLockStart(xSemaphoreCreateBinary());
+	if (writers == NULL)
+	{
+		vPortFree(buf);
+		return false;
 	}
-	return false;
+	UsartLanesStart(urt, buf, high_buf_len, writers);
+	return true;
 }
 
-size_t UsartWriteString(UsartHandle handle, const char * str)
+#endif
+
+void UsartEndMessage(UsartHandle handle, UsartLane lane)
 {
-	return UsartWrite(handle, (const uint8_t *) str, strlen(str));
+	if(handle == NULL)
+		return;
+	Usart * urt = handle;
+	UsartLanes * lanes = &urt->lanes;
+	if (lanes->high.buf == NULL)
+		return;
+	taskENTER_CRITICAL();
+	uint8_t head = lanes->end_head[lane];
+	uint8_t next = head + 1;
+	if (next == USART_MESSAGE_ENDS)
+		next = 0;
+	if (next != lanes->end_tail[lane])
+	{
+		lanes->ends[lane][head] = UsartLaneRing(urt, lane)->head;
+		lanes->end_head[lane] = next;
+	}
+	taskEXIT_CRITICAL();
+}
+
+bool UsartGetStats(UsartHandle handle, UsartStats * stats)
+{
+	if(handle == NULL)
+		return false;
+	Usart * urt = handle;
+	taskENTER_CRITICAL();
+	*stats = urt->stats;
+	taskEXIT_CRITICAL();
+	return true;
+}
+
+/* Room for the NUL behind line_len bytes in each half of buf. */
+static void UsartLineStart(UsartLines * lines, uint8_t * buf, uint16_t line_len)
+{
+	taskENTER_CRITICAL();
+	lines->size = line_len;
+	lines->buf[1] = buf + line_len + 1;
+	lines->buf[0] = buf;
+	taskEXIT_CRITICAL();
+}
+
+#if CONFIG_STATIC_ALLOCATION
+
+bool UsartLineInitStatic(UsartHandle handle, uint8_t * buf, uint16_t line_len)
+{
+	if(handle == NULL || buf == NULL)
+		return false;
+	Usart * urt = handle;
+	if (urt->lines.buf[0] == NULL)
+		UsartLineStart(&urt->lines, buf, line_len);
+	return true;
 }
 
+#else
+
+bool UsartLineInit(UsartHandle handle, uint16_t line_len)
+{
+	if(handle == NULL)
+		return false;
+	Usart * urt = handle;
+	UsartLines * lines = &urt->lines;
+	if (lines->buf[0] != NULL)
+		return true;
+	uint8_t * buf = pvPortMalloc(USART_LINE_SIZE(line_len));
+	if (buf == NULL)
+		return false;
+	UsartLineStart(lines, buf, line_len);
+	return true;
+}
+
+#endif
+
+char * UsartReadLine(UsartHandle handle, uint16_t * len)
+{
+	if(handle == NULL)
+		return NULL;
+	Usart * urt = handle;
+	UsartLines * lines = &urt->lines;
+	if (lines->buf[0] == NULL)
+		return NULL;
+	if (lines->holding)
+	{
+		/* Hand the last line back to the ISR. */
+		taskENTER_CRITICAL();
+		lines->ready &= ~(1 << (lines->reading ^ 1));
+		taskEXIT_CRITICAL();
+		lines->holding = false;
+	}
+	uint8_t bit = 1 << lines->reading;
+	while (true)
+	{
+		taskENTER_CRITICAL();
+		bool ready = (lines->ready & bit) != 0;
+		if (ready == false)
+			lines->waiter = xTaskGetCurrentTaskHandle();
+		taskEXIT_CRITICAL();
+		if (ready)
+			break;
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+	lines->holding = true;
+	char * line = (char *)lines->buf[lines->reading];
+	*len = lines->len[lines->reading];
+	lines->reading ^= 1;
+	return line;
+}
 
-ISR(USART_UDRE_vect)
+static void UsartLinePushFromISR(Usart * urt, uint8_t data, BaseType_t * woken)
 {
-	BaseType_t wake_token = pdFALSE;
-	uint8_t data;
-	if (xQueueReceiveFromISR(usart[0]->tx_queue, &data, &wake_token) == pdTRUE)
+	UsartLines * lines = &urt->lines;
+	uint8_t filling = lines->filling;
+	if (lines->ready & (1 << filling))
 	{
-		UDR0 = data;
+		urt->stats.rx_overruns++;
+		return;
 	}
-	else
+	uint8_t * buf = lines->buf[filling];
+	uint16_t fill = lines->fill;
+	buf[fill++] = data;
+	if (data != '\n' && fill < lines->size)
 	{
-		UCSR0B &= ~(1 << UDRE0);
+		lines->fill = fill;
+		return;
 	}
-	if (wake_token != pdFALSE)
+	buf[fill] = 0;
+	lines->len[filling] = fill;
+	lines->ready |= 1 << filling;
+	lines->filling = filling ^ 1;
+	lines->fill = 0;
+	if (fill > urt->stats.rx_peak)
+		urt->stats.rx_peak = fill;
+	if (lines->waiter != NULL)
 	{
-		taskYIELD();
+		vTaskNotifyGiveFromISR(lines->waiter, woken);
+		lines->waiter = NULL;
 	}
 }
 
-ISR(USART_RX_vect)
+
+/* Take the ends queued at the tail of lane, true when there was one. */
+static bool UsartLaneEndFromISR(Usart * urt, uint8_t lane)
 {
-	BaseType_t wake_token = pdFALSE;
-	uint8_t data = UDR0;
-	xQueueSendFromISR(usart[0]->rx_queue, &data, &wake_token);
-	if(wake_token == pdTRUE)
-		taskYIELD();
-}
\ No newline at end of file
+	UsartLanes * lanes = &urt->lanes;
+	uint16_t tail = UsartLaneRing(urt, lane)->tail;
+	uint8_t end = lanes->end_tail[lane];
+	bool found = false;
+	while (end != lanes->end_head[lane] && lanes->ends[lane][end] == tail)
+	{
+		if (++end == USART_MESSAGE_ENDS)
+			end = 0;
+		found = true;
+	}
+	lanes->end_tail[lane] = end;
+	return found;
+}
+
+bool UsartTxPopFromISR(UsartId id, uint8_t * data, BaseType_t * woken)
+{
+	Usart * urt = usart[id];
+	UsartLanes * lanes = &urt->lanes;
+	UsartRing * ring = &urt->tx;
+	if (lanes->high.buf != NULL)
+	{
+		/* Change lanes only between messages, the high lane first. */
+		if (lanes->busy == false || UsartLaneEndFromISR(urt, lanes->lane))
+		{
+			lanes->lane = (lanes->high.head != lanes->high.tail) ? USART_LANE_HIGH : USART_LANE_LOW;
+			UsartLaneEndFromISR(urt, lanes->lane);
+			lanes->busy = false;
+		}
+		ring = UsartLaneRing(urt, lanes->lane);
+	}
+	uint16_t tail = ring->tail;
+	if (tail == ring->head)
+		return false;
+	*data = ring->buf[tail];
+	if (++tail == ring->size)
+		tail = 0;
+	ring->tail = tail;
+	if (lanes->high.buf != NULL)
+		lanes->busy = !UsartLaneEndFromISR(urt, lanes->lane);
+	/* Wake a blocked writer once half of the ring is free again. */
+	if (ring->waiter != NULL && UsartRingCount(ring) <= ring->size / 2)
+	{
+		vTaskNotifyGiveFromISR(ring->waiter, woken);
+		ring->waiter = NULL;
+	}
+	return true;
+}
+
+void UsartRxPushFromISR(UsartId id, uint8_t data, BaseType_t * woken)
+{
+	UsartStats * stats = &usart[id]->stats;
+	stats->rx_bytes++;
+	if (usart[id]->lines.buf[0] != NULL)
+	{
+		UsartLinePushFromISR(usart[id], data, woken);
+		return;
+	}
+	UsartRing * ring = &usart[id]->rx;
+	uint16_t head = ring->head;
+	uint16_t next = head + 1;
+	if (next == ring->size)
+		next = 0;
+	if (next != ring->tail)
+	{
+		ring->buf[head] = data;
+		ring->head = next;
+		uint16_t count = UsartRingCount(ring);
+		if (count > stats->rx_peak)
+			stats->rx_peak = count;
+	}
+	else
+		stats->rx_overruns++;
+	if (ring->waiter != NULL)
+	{
+		vTaskNotifyGiveFromISR(ring->waiter, woken);
+		ring->waiter = NULL;
+	}
+}
@@ -29,6 +29,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "config.h"
 
@@ -58,16 +59,87 @@ typedef enum
 	BAUDRATE_115200
 }BaudRate;
 
-
-
+typedef enum
+{
+	USART_LANE_LOW,
+	USART_LANE_HIGH
+}UsartLane;
+
+/* Counters of a port since UsartInit. The peaks are the most bytes that ever
+ * waited in a ring, compare them with rx_buf_len and tx_buf_len. In line mode
+ * rx_peak is the longest line and rx_overruns counts the bytes that found
+ * both line buffers taken. */
+typedef struct
+{
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	uint16_t tx_peak;
+	uint16_t rx_peak;
+	/* Received bytes lost to a full RX ring. */
+	uint16_t rx_overruns;
+	/* Times UsartWrite found the TX ring full and waited. */
+	uint16_t tx_waits;
+	/* Most bytes that waited on the high lane. */
+	uint16_t tx_high_peak;
+}UsartStats;
+
+
+
+/* Bytes of a ring buffer for len bytes, and of the line buffers for line_len. */
+#define USART_RING_SIZE(len)		((len) + 1)
+#define USART_LINE_SIZE(line_len)	(2 * ((line_len) + 1))
+
+#if CONFIG_STATIC_ALLOCATION
+/* The *Static versions take no heap: the port state is reserved for every
+ * UsartId, the buffers come from the caller, sized with the macros above. */
+UsartHandle UsartInitStatic(UsartId id, BaudRate baud, uint8_t * rx_buf, size_t rx_buf_len, uint8_t * tx_buf, size_t tx_buf_len);
+#else
 UsartHandle UsartInit(UsartId id, BaudRate baud, size_t rx_buf_len, size_t tx_buf_len);
+#endif
 
 size_t UsartRead(UsartHandle handle, uint8_t * buffer, uint16_t len);
 bool UsartReadByte(UsartHandle handle, uint8_t * buffer);
 
+/* Tasks write one at a time, a write waits at most 1000 ticks for room at a
+ * time and returns the bytes it got into the ring. */
 size_t UsartWrite(UsartHandle handle, const uint8_t * data, uint16_t len);
 bool UsartWriteByte(UsartHandle handle, const uint8_t data);
 size_t UsartWriteString(UsartHandle handle, const char * str);
+/* Bytes UsartWrite can take right now without blocking. */
+size_t UsartWriteSpace(UsartHandle handle);
+
+bool UsartGetStats(UsartHandle handle, UsartStats * stats);
+
+/* Second TX ring of high_buf_len bytes for urgent messages. Writers end every
+ * message with UsartEndMessage, the TX interrupt finishes the message it has
+ * started and then serves the high lane first. UsartWrite is the low lane and
+ * ends a message with every call, UsartWriteLane leaves that to the caller so
+ * a message can take several writes. A port without lanes takes high lane
+ * writes on the low lane too. UsartLaneWait waits up to ticks for len bytes
+ * of room and returns false when they did not come. */
+#if CONFIG_STATIC_ALLOCATION
+bool UsartLanesInitStatic(UsartHandle handle, uint8_t * buf, size_t high_buf_len);
+#else
+bool UsartLanesInit(UsartHandle handle, size_t high_buf_len);
+#endif
+size_t UsartWriteLane(UsartHandle handle, UsartLane lane, const uint8_t * data, uint16_t len);
+size_t UsartLaneSpace(UsartHandle handle, UsartLane lane);
+bool UsartLaneWait(UsartHandle handle, UsartLane lane, uint16_t len, uint16_t ticks);
+void UsartEndMessage(UsartHandle handle, UsartLane lane);
+
+/* Line mode for command input. The RX interrupt collects bytes into one of two
+ * buffers of line_len bytes and wakes the reader only when a '\n' ends
+ * the line or the buffer is full, the other buffer takes the next line in the
+ * meantime. Received bytes no longer go to the RX ring. */
+#if CONFIG_STATIC_ALLOCATION
+bool UsartLineInitStatic(UsartHandle handle, uint8_t * buf, uint16_t line_len);
+#else
+bool UsartLineInit(UsartHandle handle, uint16_t line_len);
+#endif
+/* Blocks until a line is in and returns it, NUL terminated and valid until
+ * the next call. *len includes the '\n', a line without one was cut by a full
+ * buffer and continues in the next. */
+char * UsartReadLine(UsartHandle handle, uint16_t * len);
 
 
 
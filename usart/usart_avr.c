@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* ATmega328P backend of usart.c. */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+
+#include "usart_port.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#ifndef F_CPU 
+#error F_CPU "isn't defined. Please define F_CPU to 8000000UL to make this code working properly."
+#else
+#if F_CPU != 8000000UL
+#error "Please set F_CPU to 8000000UL or add logic for other clock speed."
+#endif
+#endif
+
+
+/* Only USART0 at 9600 baud is wired up. */
+bool UsartPortInit(UsartId id, BaudRate baud)
+{
+	if (id != USART_ID_0)
+		return false;
+	UCSR0B = (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
+	UCSR0C = (1 << UCSZ00) | (1 << UCSZ01);
+	UBRR0 = 51;
+	return true;
+}
+
+/* The UDRE interrupt only ever clears UDRIE0, racing it just costs one
+ * interrupt with nothing to send. */
+void UsartPortStartTx(UsartId id)
+{
+	UCSR0B |= 1 << UDRIE0;
+}
+
+
+ISR(USART_UDRE_vect)
+{
+	BaseType_t wake_token = pdFALSE;
+	uint8_t data;
+	if (UsartTxPopFromISR(USART_ID_0, &data, &wake_token))
+	{
+		UDR0 = data;
+	}
+	else
+	{
+		UCSR0B &= ~(1 << UDRIE0);
+	}
+	if (wake_token != pdFALSE)
+	{
+		taskYIELD();
+	}
+}
+
+ISR(USART_RX_vect)
+{
+	BaseType_t wake_token = pdFALSE;
+	UsartRxPushFromISR(USART_ID_0, UDR0, &wake_token);
+	if(wake_token == pdTRUE)
+		taskYIELD();
+}
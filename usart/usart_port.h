@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Md. Mahmudul Hasan Sumon
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef USART_PORT_INCLUDE_H_
+#define USART_PORT_INCLUDE_H_
+
+/* Interface between the portable ring buffer code in usart.c and a hardware
+ * backend (usart_avr.c, port/linux/usart_linux.c). Not for application use. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "usart.h"
+#include "FreeRTOS.h"
+
+
+/* Implemented by the backend. */
+bool UsartPortInit(UsartId id, BaudRate baud);
+/* Bytes were queued for transmit. Called from a task after the critical
+ * section that queued them, it may use the FreeRTOS task API. */
+void UsartPortStartTx(UsartId id);
+
+/* Called by the backend from its TX/RX interrupt, or whatever stands in for
+ * it, with interrupts masked. */
+bool UsartTxPopFromISR(UsartId id, uint8_t * data, BaseType_t * woken);
+void UsartRxPushFromISR(UsartId id, uint8_t data, BaseType_t * woken);
+
+
+#endif /* USART_PORT_INCLUDE_H_ */